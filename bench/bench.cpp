@@ -0,0 +1,655 @@
+/* Renders deterministic synthetic scenes headlessly and prints the results as JSON to stdout.
+ * It can also record or compare golden images and timings of the scenes, to check optimizations.
+ * Build with "make -f Makefile.pc bench", see README.md. */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "gl.h"
+#include "gldrawarray.h"
+#include "golden.h"
+#include "texturetools.h"
+#include "trace.h"
+
+#ifndef RENDER_STATS
+    #error The benchmark counts triangles and pixels with RENDER_STATS
+#endif
+
+#ifndef BENCH_REVISION
+    #define BENCH_REVISION "unknown"
+#endif
+
+static COLOR framebuffer[SCREEN_WIDTH*SCREEN_HEIGHT];
+static TEXTURE screen_texture = {SCREEN_WIDTH, SCREEN_HEIGHT, false, 0, framebuffer, TEXTURE_RGB565, nullptr, nullptr};
+
+//Interpolation can sample a texel beyond the edges of a texture, so the textures are surrounded
+//by zeroes to keep the output reproducible for the golden images
+#define TEXTURE_PADDING (2*64)
+static COLOR atlas_pixels[TEXTURE_PADDING + 64*64 + TEXTURE_PADDING], holes_pixels[TEXTURE_PADDING + 64*64 + TEXTURE_PADDING];
+static TEXTURE atlas_texture = {64, 64, false, 0, atlas_pixels + TEXTURE_PADDING, TEXTURE_RGB565, nullptr, nullptr};
+static TEXTURE holes_texture = {64, 64, true, 0, holes_pixels + TEXTURE_PADDING, TEXTURE_RGB565, nullptr, nullptr};
+
+static TEXTURE *atlas, *holes;
+static COMPILED_SPRITE *sprite;
+
+//Same sequence on every run and platform
+static uint32_t random_state;
+
+static unsigned int rnd(const unsigned int max)
+{
+    random_state = random_state * 1103515245 + 12345;
+    return (random_state >> 8) % max;
+}
+
+static COLOR rndColor()
+{
+    return rnd(0x10000);
+}
+
+//4x4 tiles of 16x16 pixels, each with its own pattern
+static TEXTURE *makeAtlas()
+{
+    TEXTURE *tex = &atlas_texture;
+    for(unsigned int y = 0; y < 64; ++y)
+        for(unsigned int x = 0; x < 64; ++x)
+        {
+            const unsigned int tile = (y / 16) * 4 + x / 16;
+            const unsigned int shade = ((x ^ y) & 3) + (((x / 4) + (y / 4)) & 1) * 4;
+            tex->bitmap[x + y*64] = colorRGB(GLFix(int((tile * 5) % 16)) / 16, GLFix(int(shade)) / 8, GLFix(int(15 - tile)) / 16) | 0x0821;
+        }
+
+    return tex;
+}
+
+//Black (transparent) circles in a pattern
+static TEXTURE *makeHoles()
+{
+    TEXTURE *tex = &holes_texture;
+    for(unsigned int y = 0; y < 64; ++y)
+        for(unsigned int x = 0; x < 64; ++x)
+        {
+            const int dx = int(x % 16) - 8, dy = int(y % 16) - 8;
+            tex->bitmap[x + y*64] = dx*dx + dy*dy < 25 ? 0 : colorRGB(GLFix(int(x)) / 64, GLFix(int(y)) / 64, GLFix(1) / 2);
+        }
+
+    return tex;
+}
+
+//Adds the quad o, o+a, o+a+b, o+b, which is visible from the side a x b points to
+static void addQuad(std::vector<VERTEX> &quads, const int o[3], const int a[3], const int b[3], const unsigned int tile, const COLOR c = 0)
+{
+    const int u = (tile % 4) * 16, v = (tile / 4) * 16;
+    quads.emplace_back(o[0], o[1], o[2], u, v + 15, c);
+    quads.emplace_back(o[0] + a[0], o[1] + a[1], o[2] + a[2], u, v, c);
+    quads.emplace_back(o[0] + a[0] + b[0], o[1] + a[1] + b[1], o[2] + a[2] + b[2], u + 15, v, c);
+    quads.emplace_back(o[0] + b[0], o[1] + b[1], o[2] + b[2], u + 15, v + 15, c);
+}
+
+//Voxel chunk: 16x16 columns of blocks with a heightmap, only the exposed faces are drawn
+#define CHUNK_SIZE 16
+#define BLOCK_SIZE 16
+static std::vector<VERTEX> chunk_quads;
+
+static void initChunk()
+{
+    int height[CHUNK_SIZE + 2][CHUNK_SIZE + 2] = {};
+    for(int z = 1; z <= CHUNK_SIZE; ++z)
+        for(int x = 1; x <= CHUNK_SIZE; ++x)
+            height[z][x] = 2 + (x * 3 + z * 5) % 7 / 2 + rnd(3);
+
+    const int s = BLOCK_SIZE;
+    const int dx[3] = {s, 0, 0}, dy[3] = {0, s, 0}, dz[3] = {0, 0, s};
+    for(int z = 1; z <= CHUNK_SIZE; ++z)
+        for(int x = 1; x <= CHUNK_SIZE; ++x)
+            for(int y = 0; y < height[z][x]; ++y)
+            {
+                const int x0 = (x - 1) * s, y0 = y * s, z0 = (z - 1) * s;
+                const unsigned int tile = y == height[z][x] - 1 ? 0 : 1 + y % 3;
+                if(y == height[z][x] - 1)
+                {
+                    const int o[3] = {x0, y0 + s, z0};
+                    addQuad(chunk_quads, o, dz, dx, tile);
+                }
+                if(y >= height[z - 1][x])
+                {
+                    const int o[3] = {x0, y0, z0};
+                    addQuad(chunk_quads, o, dy, dx, tile);
+                }
+                if(y >= height[z + 1][x])
+                {
+                    const int o[3] = {x0, y0, z0 + s};
+                    addQuad(chunk_quads, o, dx, dy, tile);
+                }
+                if(y >= height[z][x - 1])
+                {
+                    const int o[3] = {x0, y0, z0};
+                    addQuad(chunk_quads, o, dz, dy, tile);
+                }
+                if(y >= height[z][x + 1])
+                {
+                    const int o[3] = {x0 + s, y0, z0};
+                    addQuad(chunk_quads, o, dy, dz, tile);
+                }
+            }
+}
+
+static void drawChunk(const unsigned int frame)
+{
+    glPushMatrix();
+    glTranslatef(0, 0, 450);
+    nglRotateX(-30);
+    nglRotateY((frame * 3) % 360);
+    glTranslatef(-CHUNK_SIZE * BLOCK_SIZE / 2, -48, -CHUNK_SIZE * BLOCK_SIZE / 2);
+
+    glBindTexture(atlas);
+    glBegin(GL_QUADS);
+    nglAddVertices(chunk_quads.data(), chunk_quads.size());
+    glEnd();
+    glPopMatrix();
+}
+
+//Quads covering most of the screen, front to back so that the depth test rejects most of the later ones
+static void drawLargeQuads(const unsigned int frame)
+{
+    glBindTexture(atlas);
+    for(int i = 0; i < 4; ++i)
+    {
+        glPushMatrix();
+        glTranslatef(0, 0, 300 + i * 100);
+        nglRotateZ((frame * 2 + i * 20) % 360);
+
+        const int size = 250 + i * 80;
+        glBegin(GL_QUADS);
+        nglAddVertex(VERTEX(-size, -size, 0, 0, 63, 0));
+        nglAddVertex(VERTEX(-size, size, 0, 0, 0, 0));
+        nglAddVertex(VERTEX(size, size, 0, 63, 0, 0));
+        nglAddVertex(VERTEX(size, -size, 0, 63, 63, 0));
+        glEnd();
+        glPopMatrix();
+    }
+}
+
+//Coloured triangles only a few pixels large
+#define TINY_TRIANGLES 4000
+static std::vector<VERTEX> tiny_triangles;
+
+static void initTinyTriangles()
+{
+    for(unsigned int i = 0; i < TINY_TRIANGLES; ++i)
+    {
+        const int x = int(rnd(500)) - 250, y = int(rnd(360)) - 180, z = 300 + rnd(200), size = 2 + rnd(5);
+        const COLOR c = rndColor();
+        tiny_triangles.emplace_back(x, y, z, 0, 0, c);
+        tiny_triangles.emplace_back(x, y + size, z, 0, 0, c);
+        tiny_triangles.emplace_back(x + size, y, z, 0, 0, c);
+    }
+}
+
+static void drawTinyTriangles(const unsigned int frame)
+{
+    glPushMatrix();
+    glTranslatef(int(frame % 20) - 10, 0, 0);
+    glBindTexture(nullptr);
+    glBegin(GL_TRIANGLES);
+    nglAddVertices(tiny_triangles.data(), tiny_triangles.size());
+    glEnd();
+    glPopMatrix();
+}
+
+//Full screen quads back to front, each of them overwrites the previous ones
+#define OVERDRAW_LAYERS 12
+static void drawOverdraw(const unsigned int frame)
+{
+    glBindTexture(atlas);
+    for(int i = OVERDRAW_LAYERS; i--;)
+    {
+        const int z = 200 + i * 20, size = z, offset = int((frame + i * 7) % 32);
+        glBegin(GL_QUADS);
+        nglAddVertex(VERTEX(-size, -size, z, offset, 63, 0));
+        nglAddVertex(VERTEX(-size, size, z, offset, 0, 0));
+        nglAddVertex(VERTEX(size, size, z, 31 + offset, 0, 0));
+        nglAddVertex(VERTEX(size, -size, z, 31 + offset, 63, 0));
+        glEnd();
+    }
+}
+
+//Textured quads with transparent holes, which have to test every texel
+#define TRANSPARENT_QUADS 150
+static std::vector<VERTEX> transparent_quads;
+
+static void initTransparent()
+{
+    for(unsigned int i = 0; i < TRANSPARENT_QUADS; ++i)
+    {
+        const int x = int(rnd(500)) - 280, y = int(rnd(380)) - 210, z = 250 + rnd(300);
+        transparent_quads.emplace_back(x, y, z, 0, 63, TEXTURE_TRANSPARENT);
+        transparent_quads.emplace_back(x, y + 64, z, 0, 0, TEXTURE_TRANSPARENT);
+        transparent_quads.emplace_back(x + 64, y + 64, z, 63, 0, TEXTURE_TRANSPARENT);
+        transparent_quads.emplace_back(x + 64, y, z, 63, 63, TEXTURE_TRANSPARENT);
+    }
+}
+
+static void drawTransparent(const unsigned int frame)
+{
+    glPushMatrix();
+    glTranslatef(0, int(frame % 16) - 8, 0);
+    glBindTexture(holes);
+    glBegin(GL_QUADS);
+    nglAddVertices(transparent_quads.data(), transparent_quads.size());
+    glEnd();
+    glPopMatrix();
+}
+
+//A cube mesh drawn with nglDrawArrayInstanced
+#define CUBE_INSTANCES 10
+static const VECTOR3 cube_positions[8] = {{0, 0, 0}, {0, 24, 0}, {24, 24, 0}, {24, 0, 0}, {0, 0, 24}, {0, 24, 24}, {24, 24, 24}, {24, 0, 24}};
+static const IndexedVertex cube_faces[24] = {
+    {0, 0, 15, 0}, {1, 0, 0, 0}, {2, 15, 0, 0}, {3, 15, 15, 0},
+    {7, 16, 15, 0}, {6, 16, 0, 0}, {5, 31, 0, 0}, {4, 31, 15, 0},
+    {4, 32, 15, 0}, {5, 32, 0, 0}, {1, 47, 0, 0}, {0, 47, 15, 0},
+    {3, 48, 15, 0}, {2, 48, 0, 0}, {6, 63, 0, 0}, {7, 63, 15, 0},
+    {1, 0, 31, 0}, {5, 0, 16, 0}, {6, 15, 16, 0}, {2, 15, 31, 0},
+    {4, 16, 31, 0}, {0, 16, 16, 0}, {3, 31, 16, 0}, {7, 31, 31, 0}};
+static MATRIX cube_instances[CUBE_INSTANCES*CUBE_INSTANCES];
+
+static void initInstances()
+{
+    for(unsigned int i = 0; i < CUBE_INSTANCES*CUBE_INSTANCES; ++i)
+    {
+        MATRIX &m = cube_instances[i];
+        m.data[0][0] = m.data[1][1] = m.data[2][2] = 1;
+        m.data[0][3] = int(i % CUBE_INSTANCES) * 48 - CUBE_INSTANCES * 24;
+        m.data[1][3] = int(rnd(40)) - 20;
+        m.data[2][3] = int(i / CUBE_INSTANCES) * 48 - CUBE_INSTANCES * 24;
+    }
+}
+
+static void drawInstances(const unsigned int frame)
+{
+    glPushMatrix();
+    glTranslatef(0, -20, 450);
+    nglRotateX(25);
+    nglRotateY((frame * 2) % 360);
+    glBindTexture(atlas);
+    nglDrawArrayInstanced(cube_faces, 24, cube_positions, 8, cube_instances, CUBE_INSTANCES*CUBE_INSTANCES, GL_QUADS);
+    glPopMatrix();
+}
+
+//2D only: Scaled blits, blending and compiled sprites
+static void drawBlits(const unsigned int frame)
+{
+    for(unsigned int i = 0; i < 40; ++i)
+    {
+        const unsigned int w = 16 + (i * 13) % 96, h = 16 + (i * 29) % 64;
+        drawTexture(*atlas, screen_texture, (i * 7) % 48, (i * 11) % 48, 16, 16,
+                    (i * 37 + frame) % (SCREEN_WIDTH - w), (i * 53) % (SCREEN_HEIGHT - h), w, h);
+    }
+
+    for(unsigned int i = 0; i < 20; ++i)
+        drawTextureOverlay(*holes, 0, 0, screen_texture, (i * 41 + frame) % (SCREEN_WIDTH - 64), (i * 23) % (SCREEN_HEIGHT - 64), 64, 64, 64 + i * 8);
+
+    for(unsigned int i = 0; i < 60; ++i)
+        drawSprite(*sprite, screen_texture, int((i * 59 + frame * 3) % (SCREEN_WIDTH + 64)) - 64, int((i * 31) % (SCREEN_HEIGHT + 64)) - 64);
+}
+
+struct SCENE {
+    const char *name;
+    void (*init)();
+    void (*draw)(const unsigned int frame);
+};
+
+static const SCENE scenes[] = {
+    {"voxel_chunk", initChunk, drawChunk},
+    {"large_quads", nullptr, drawLargeQuads},
+    {"tiny_triangles", initTinyTriangles, drawTinyTriangles},
+    {"overdraw", nullptr, drawOverdraw},
+    {"transparent", initTransparent, drawTransparent},
+    {"instanced_cubes", initInstances, drawInstances},
+    {"blits", nullptr, drawBlits},
+};
+
+//Nearest rank, sorted has to be sorted
+static double percentile(const std::vector<double> &sorted, const unsigned int p)
+{
+    const size_t rank = (sorted.size() * p + 99) / 100;
+    return sorted[std::max<size_t>(rank, 1) - 1];
+}
+
+//Frame of each scene compared against the golden images, independent of --frames
+#define GOLDEN_FRAME 7
+
+static void renderFrame(const SCENE &scene, const unsigned int frame)
+{
+    glColor3f(0.4f, 0.6f, 1.0f);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    scene.draw(frame);
+    nglDisplay();
+}
+
+struct CONFIG_OPTION {
+    const char *name;
+    bool enabled;
+    bool changes_output; //DIRTY_RECTANGLES and LAZY_CLEAR only change what gets cleared and presented
+};
+
+static std::vector<CONFIG_OPTION> configOptions()
+{
+    std::vector<CONFIG_OPTION> options;
+    #define ADD_OPTION(option, enabled, changes_output) options.push_back({#option, enabled, changes_output})
+    #ifdef TEXTURE_SUPPORT
+        ADD_OPTION(TEXTURE_SUPPORT, true, true);
+    #else
+        ADD_OPTION(TEXTURE_SUPPORT, false, true);
+    #endif
+    #ifdef INTERPOLATE_COLORS
+        ADD_OPTION(INTERPOLATE_COLORS, true, true);
+    #else
+        ADD_OPTION(INTERPOLATE_COLORS, false, true);
+    #endif
+    #ifdef Z_CLIPPING
+        ADD_OPTION(Z_CLIPPING, true, true);
+    #else
+        ADD_OPTION(Z_CLIPPING, false, true);
+    #endif
+    #ifdef WIDE_FIXED_POINT
+        ADD_OPTION(WIDE_FIXED_POINT, true, true);
+    #else
+        ADD_OPTION(WIDE_FIXED_POINT, false, true);
+    #endif
+    #ifdef DIRTY_RECTANGLES
+        ADD_OPTION(DIRTY_RECTANGLES, true, false);
+    #else
+        ADD_OPTION(DIRTY_RECTANGLES, false, false);
+    #endif
+    #ifdef LAZY_CLEAR
+        ADD_OPTION(LAZY_CLEAR, true, false);
+    #else
+        ADD_OPTION(LAZY_CLEAR, false, false);
+    #endif
+    #ifdef LIGHTING
+        ADD_OPTION(LIGHTING, true, true);
+    #else
+        ADD_OPTION(LIGHTING, false, true);
+    #endif
+    #undef ADD_OPTION
+    return options;
+}
+
+//The enabled options, as recorded in baseline.txt
+static std::string configString()
+{
+    std::string config;
+    for(auto &option : configOptions())
+        if(option.enabled)
+            config += config.empty() ? option.name : std::string(" ") + option.name;
+
+    return config;
+}
+
+//The options of a configString which golden images depend on
+static std::string outputConfig(const std::string &config)
+{
+    const std::vector<CONFIG_OPTION> options = configOptions();
+    std::string output;
+    for(size_t start = 0; start < config.size();)
+    {
+        size_t end = config.find(' ', start);
+        if(end == std::string::npos)
+            end = config.size();
+
+        const std::string name = config.substr(start, end - start);
+        auto option = std::find_if(options.begin(), options.end(), [&name](const CONFIG_OPTION &o) { return name == o.name; });
+        if(!name.empty() && (option == options.end() || option->changes_output))
+            output += output.empty() ? name : " " + name;
+
+        start = end + 1;
+    }
+
+    return output;
+}
+
+static void printConfig()
+{
+    printf("  \"config\": {");
+    const char *separator = "";
+    for(auto &option : configOptions())
+    {
+        printf("%s\"%s\": %s", separator, option.name, option.enabled ? "true" : "false");
+        separator = ", ";
+    }
+    printf("},\n");
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [--frames N] [--warmup N] [--scene NAME]... [--record DIR | --compare DIR]\n"
+                    "       [--tolerance N] [--depth-tolerance N] [--max-slowdown PERCENT]\n", name);
+    #ifdef TRACE_PROFILING
+        fputs("       [--trace DIR]\n", stderr);
+    #endif
+    fputs("Scenes:", stderr);
+    for(const SCENE &scene : scenes)
+        fprintf(stderr, " %s", scene.name);
+    fputc('\n', stderr);
+}
+
+int main(int argc, char **argv)
+{
+    unsigned int frames = 200, warmup = 10;
+    std::vector<const SCENE*> selected;
+    std::string record_dir, compare_dir, trace_dir;
+    unsigned int color_tolerance = 0, depth_tolerance = 0;
+    double max_slowdown = 10;
+
+    for(int i = 1; i < argc; ++i)
+    {
+        if(strcmp(argv[i], "--frames") == 0 && i + 1 < argc)
+            frames = std::max(1, atoi(argv[++i]));
+        else if(strcmp(argv[i], "--warmup") == 0 && i + 1 < argc)
+            warmup = std::max(0, atoi(argv[++i]));
+        else if(strcmp(argv[i], "--record") == 0 && i + 1 < argc)
+            record_dir = argv[++i];
+        else if(strcmp(argv[i], "--compare") == 0 && i + 1 < argc)
+            compare_dir = argv[++i];
+        else if(strcmp(argv[i], "--tolerance") == 0 && i + 1 < argc)
+            color_tolerance = std::max(0, atoi(argv[++i]));
+        else if(strcmp(argv[i], "--depth-tolerance") == 0 && i + 1 < argc)
+            depth_tolerance = std::max(0, atoi(argv[++i]));
+        else if(strcmp(argv[i], "--max-slowdown") == 0 && i + 1 < argc)
+            max_slowdown = atof(argv[++i]);
+        #ifdef TRACE_PROFILING
+            else if(strcmp(argv[i], "--trace") == 0 && i + 1 < argc)
+                trace_dir = argv[++i];
+        #endif
+        else if(strcmp(argv[i], "--scene") == 0 && i + 1 < argc)
+        {
+            const char *name = argv[++i];
+            auto it = std::find_if(std::begin(scenes), std::end(scenes), [name](const SCENE &scene) { return strcmp(scene.name, name) == 0; });
+            if(it == std::end(scenes))
+            {
+                fprintf(stderr, "Unknown scene '%s'\n", name);
+                usage(argv[0]);
+                return 1;
+            }
+
+            selected.push_back(it);
+        }
+        else
+        {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if(!record_dir.empty() && !compare_dir.empty())
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if(selected.empty())
+        for(const SCENE &scene : scenes)
+            selected.push_back(&scene);
+
+    BASELINE baseline, results;
+    results.revision = BENCH_REVISION;
+    results.config = configString();
+    if(!compare_dir.empty())
+    {
+        if(!loadBaseline(compare_dir + "/baseline.txt", baseline))
+        {
+            fprintf(stderr, "Couldn't read %s/baseline.txt, record it first with --record\n", compare_dir.c_str());
+            return 1;
+        }
+
+        if(outputConfig(baseline.config) != outputConfig(results.config))
+        {
+            fprintf(stderr, "The goldens were recorded with the options '%s', but this build has '%s'\n", baseline.config.c_str(), results.config.c_str());
+            return 1;
+        }
+
+        if(baseline.config != results.config)
+            fprintf(stderr, "The timings were recorded with the options '%s', this build has '%s'. They're only shown.\n",
+                    baseline.config.c_str(), results.config.c_str());
+
+        fprintf(stderr, "Comparing against revision %s\n", baseline.revision.c_str());
+    }
+
+    nglInit();
+    nglSetBuffer(framebuffer);
+
+    random_state = 1;
+    atlas = makeAtlas();
+    holes = makeHoles();
+    sprite = compileSprite(*holes);
+
+    //The generated content mustn't depend on which scenes are selected
+    for(const SCENE &scene : scenes)
+        if(scene.init)
+            scene.init();
+
+    printf("{\n  \"revision\": \"%s\",\n", BENCH_REVISION);
+    printConfig();
+    printf("  \"frames\": %u,\n  \"scenes\": [\n", frames);
+
+    bool failed = false;
+
+    for(const SCENE *scene : selected)
+    {
+        fprintf(stderr, "Running %s...\n", scene->name);
+
+        std::vector<double> frame_ms;
+        frame_ms.reserve(frames);
+        unsigned long long triangles = 0, pixels = 0;
+
+        for(unsigned int frame = 0; frame < warmup + frames; ++frame)
+        {
+            const auto start = std::chrono::steady_clock::now();
+            renderFrame(*scene, frame);
+            const auto end = std::chrono::steady_clock::now();
+            if(frame < warmup)
+                continue;
+
+            frame_ms.push_back(std::chrono::duration<double, std::milli>(end - start).count());
+            triangles += nglGetStats().triangles;
+            pixels += nglGetStats().pixels_written;
+        }
+
+        double total_ms = 0;
+        for(double ms : frame_ms)
+            total_ms += ms;
+
+        std::sort(frame_ms.begin(), frame_ms.end());
+
+        const double seconds = total_ms / 1000;
+        printf("    {\"name\": \"%s\", \"triangles_per_frame\": %llu, \"pixels_per_frame\": %llu, "
+               "\"triangles_per_second\": %.0f, \"pixels_per_second\": %.0f,\n"
+               "     \"frame_ms\": {\"mean\": %.4f, \"min\": %.4f, \"p50\": %.4f, \"p95\": %.4f, \"p99\": %.4f, \"max\": %.4f}}%s\n",
+               scene->name, triangles / frames, pixels / frames,
+               seconds > 0 ? triangles / seconds : 0, seconds > 0 ? pixels / seconds : 0,
+               total_ms / frames, frame_ms.front(), percentile(frame_ms, 50), percentile(frame_ms, 95), percentile(frame_ms, 99), frame_ms.back(),
+               scene == selected.back() ? "" : ",");
+
+        #ifdef TRACE_PROFILING
+            //The buffers only keep the latest events, so each scene gets its own trace of its last frames
+            if(!trace_dir.empty() && !traceWrite((trace_dir + "/" + scene->name + ".trace.json").c_str()))
+            {
+                fprintf(stderr, "Couldn't write the trace of %s into %s\n", scene->name, trace_dir.c_str());
+                failed = true;
+            }
+
+            traceClear();
+        #endif
+
+        results.frame_ms[scene->name] = percentile(frame_ms, 50);
+        if(record_dir.empty() && compare_dir.empty())
+            continue;
+
+        renderFrame(*scene, GOLDEN_FRAME);
+        GOLDEN_IMAGE image;
+        captureGolden(image, framebuffer);
+
+        if(!record_dir.empty())
+        {
+            if(!saveGolden(record_dir + "/" + scene->name, image))
+            {
+                fprintf(stderr, "Couldn't write the golden images of %s into %s\n", scene->name, record_dir.c_str());
+                failed = true;
+            }
+
+            continue;
+        }
+
+        GOLDEN_IMAGE golden;
+        if(!loadGolden(compare_dir + "/" + scene->name, golden))
+        {
+            fprintf(stderr, "FAIL %s: No golden images\n", scene->name);
+            failed = true;
+            continue;
+        }
+
+        const GOLDEN_DIFF diff = compareGolden(golden, image, color_tolerance, depth_tolerance);
+        const bool output_changed = diff.color_pixels > 0 || diff.depth_pixels > 0;
+        fprintf(stderr, "%s %s: %u pixels with a different colour (max. %u), %u with a different depth (max. %u)\n",
+                output_changed ? "FAIL" : "ok  ", scene->name, diff.color_pixels, diff.max_color, diff.depth_pixels, diff.max_depth);
+
+        const std::string diff_path = compare_dir + "/" + scene->name + ".diff.ppm";
+        if(output_changed)
+        {
+            if(saveGoldenDiff(diff_path, golden, image, color_tolerance, depth_tolerance))
+                fprintf(stderr, "     Differences in %s\n", diff_path.c_str());
+
+            failed = true;
+        }
+        else
+            remove(diff_path.c_str()); //From an earlier comparison
+
+        auto baseline_ms = baseline.frame_ms.find(scene->name);
+        if(baseline_ms == baseline.frame_ms.end())
+            continue;
+
+        const double change = (results.frame_ms[scene->name] / baseline_ms->second - 1) * 100;
+        const bool slower = change > max_slowdown && baseline.config == results.config;
+        fprintf(stderr, "%s %s: Median frame time %.4f ms, was %.4f ms (%+.1f%%)\n",
+                slower ? "FAIL" : "ok  ", scene->name, results.frame_ms[scene->name], baseline_ms->second, change);
+        failed = failed || slower;
+    }
+
+    printf("  ]\n}\n");
+
+    if(!record_dir.empty() && !saveBaseline(record_dir + "/baseline.txt", results))
+    {
+        fprintf(stderr, "Couldn't write %s/baseline.txt\n", record_dir.c_str());
+        failed = true;
+    }
+
+    deleteSprite(sprite);
+    nglUninit();
+    return failed ? 2 : 0;
+}
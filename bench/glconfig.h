@@ -0,0 +1,13 @@
+//Configuration of the benchmark: The defaults of glconfig_example.h with textures and statistics.
+//Other modes can be compared by defining more options, like "make -f Makefile.pc bench BENCH_FLAGS=-DLAZY_CLEAR".
+#ifndef INTERPOLATE_COLORS
+    #ifndef TEXTURE_SUPPORT
+        #define TEXTURE_SUPPORT
+    #endif
+#endif
+
+#ifndef RENDER_STATS
+    #define RENDER_STATS
+#endif
+
+#include "../glconfig_example.h"
@@ -0,0 +1,220 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "golden.h"
+
+static inline void expand(const COLOR c, unsigned int rgb[3])
+{
+    rgb[0] = c >> 11;
+    rgb[1] = (c >> 5) & 0x3F;
+    rgb[2] = c & 0x1F;
+    rgb[0] = rgb[0] << 3 | rgb[0] >> 2;
+    rgb[1] = rgb[1] << 2 | rgb[1] >> 4;
+    rgb[2] = rgb[2] << 3 | rgb[2] >> 2;
+}
+
+static unsigned int colorDifference(const COLOR a, const COLOR b)
+{
+    unsigned int rgb_a[3], rgb_b[3];
+    expand(a, rgb_a);
+    expand(b, rgb_b);
+
+    unsigned int difference = 0;
+    for(unsigned int i = 0; i < 3; ++i)
+        difference = std::max(difference, unsigned(std::abs(int(rgb_a[i]) - int(rgb_b[i]))));
+
+    return difference;
+}
+
+void captureGolden(GOLDEN_IMAGE &image, const COLOR *frame)
+{
+    image.color.assign(frame, frame + SCREEN_WIDTH*SCREEN_HEIGHT);
+    image.depth.resize(SCREEN_WIDTH*SCREEN_HEIGHT);
+    for(unsigned int y = 0; y < SCREEN_HEIGHT; ++y)
+        for(unsigned int x = 0; x < SCREEN_WIDTH; ++x)
+            image.depth[x + y*SCREEN_WIDTH] = nglZBufferAt(x, y).floor();
+}
+
+static bool writePPM(const std::string &path, const std::vector<uint8_t> &rgb)
+{
+    FILE *file = fopen(path.c_str(), "wb");
+    if(!file)
+        return false;
+
+    const bool ok = fprintf(file, "P6 %d %d 255\n", SCREEN_WIDTH, SCREEN_HEIGHT) >= 0
+            && fwrite(rgb.data(), rgb.size(), 1, file) == 1;
+    return fclose(file) == 0 && ok;
+}
+
+//Reads the header of a PPM or PGM with the size of the screen, written by this file
+static FILE *openNetpbm(const std::string &path, const char *magic, const unsigned int max_value)
+{
+    FILE *file = fopen(path.c_str(), "rb");
+    if(!file)
+        return nullptr;
+
+    char format[3] = {};
+    unsigned int width, height, max;
+    if(fscanf(file, "%2s %u %u %u", format, &width, &height, &max) != 4 || fgetc(file) == EOF
+       || strcmp(format, magic) != 0 || width != SCREEN_WIDTH || height != SCREEN_HEIGHT || max != max_value)
+    {
+        printf("%s isn't a %dx%d %s file!\n", path.c_str(), SCREEN_WIDTH, SCREEN_HEIGHT, magic);
+        fclose(file);
+        return nullptr;
+    }
+
+    return file;
+}
+
+bool saveGolden(const std::string &path, const GOLDEN_IMAGE &image)
+{
+    std::vector<uint8_t> data(SCREEN_WIDTH*SCREEN_HEIGHT*3);
+    for(unsigned int i = 0; i < SCREEN_WIDTH*SCREEN_HEIGHT; ++i)
+    {
+        unsigned int rgb[3];
+        expand(image.color[i], rgb);
+        std::copy(rgb, rgb + 3, data.begin() + i*3);
+    }
+
+    if(!writePPM(path + ".ppm", data))
+        return false;
+
+    //16-bit PGMs are big-endian
+    data.resize(SCREEN_WIDTH*SCREEN_HEIGHT*2);
+    for(unsigned int i = 0; i < SCREEN_WIDTH*SCREEN_HEIGHT; ++i)
+    {
+        data[i*2] = image.depth[i] >> 8;
+        data[i*2 + 1] = image.depth[i] & 0xFF;
+    }
+
+    FILE *file = fopen((path + ".depth.pgm").c_str(), "wb");
+    if(!file)
+        return false;
+
+    const bool ok = fprintf(file, "P5 %d %d 65535\n", SCREEN_WIDTH, SCREEN_HEIGHT) >= 0
+            && fwrite(data.data(), data.size(), 1, file) == 1;
+    return fclose(file) == 0 && ok;
+}
+
+bool loadGolden(const std::string &path, GOLDEN_IMAGE &image)
+{
+    std::vector<uint8_t> data(SCREEN_WIDTH*SCREEN_HEIGHT*3);
+
+    FILE *file = openNetpbm(path + ".ppm", "P6", 255);
+    if(!file)
+        return false;
+
+    bool ok = fread(data.data(), data.size(), 1, file) == 1;
+    fclose(file);
+    if(!ok)
+        return false;
+
+    image.color.resize(SCREEN_WIDTH*SCREEN_HEIGHT);
+    for(unsigned int i = 0; i < SCREEN_WIDTH*SCREEN_HEIGHT; ++i)
+        image.color[i] = (data[i*3] >> 3) << 11 | (data[i*3 + 1] >> 2) << 5 | data[i*3 + 2] >> 3;
+
+    file = openNetpbm(path + ".depth.pgm", "P5", 65535);
+    if(!file)
+        return false;
+
+    data.resize(SCREEN_WIDTH*SCREEN_HEIGHT*2);
+    ok = fread(data.data(), data.size(), 1, file) == 1;
+    fclose(file);
+    if(!ok)
+        return false;
+
+    image.depth.resize(SCREEN_WIDTH*SCREEN_HEIGHT);
+    for(unsigned int i = 0; i < SCREEN_WIDTH*SCREEN_HEIGHT; ++i)
+        image.depth[i] = data[i*2] << 8 | data[i*2 + 1];
+
+    return true;
+}
+
+GOLDEN_DIFF compareGolden(const GOLDEN_IMAGE &golden, const GOLDEN_IMAGE &image, const unsigned int color_tolerance, const unsigned int depth_tolerance)
+{
+    GOLDEN_DIFF diff = {};
+    for(unsigned int i = 0; i < SCREEN_WIDTH*SCREEN_HEIGHT; ++i)
+    {
+        const unsigned int color = colorDifference(golden.color[i], image.color[i]);
+        const unsigned int depth = std::abs(int(golden.depth[i]) - int(image.depth[i]));
+
+        diff.max_color = std::max(diff.max_color, color);
+        diff.max_depth = std::max(diff.max_depth, depth);
+        if(color > color_tolerance)
+            ++diff.color_pixels;
+        if(depth > depth_tolerance)
+            ++diff.depth_pixels;
+    }
+
+    return diff;
+}
+
+bool saveGoldenDiff(const std::string &path, const GOLDEN_IMAGE &golden, const GOLDEN_IMAGE &image, const unsigned int color_tolerance, const unsigned int depth_tolerance)
+{
+    std::vector<uint8_t> rgb(SCREEN_WIDTH*SCREEN_HEIGHT*3);
+    for(unsigned int i = 0; i < SCREEN_WIDTH*SCREEN_HEIGHT; ++i)
+    {
+        uint8_t *pixel = rgb.data() + i*3;
+        if(colorDifference(golden.color[i], image.color[i]) > color_tolerance)
+        {
+            pixel[0] = 255;
+            pixel[1] = pixel[2] = 0;
+        }
+        else if(unsigned(std::abs(int(golden.depth[i]) - int(image.depth[i]))) > depth_tolerance)
+        {
+            pixel[0] = pixel[1] = 255;
+            pixel[2] = 0;
+        }
+        else
+        {
+            unsigned int c[3];
+            expand(golden.color[i], c);
+            for(unsigned int j = 0; j < 3; ++j)
+                pixel[j] = c[j] / 4;
+        }
+    }
+
+    return writePPM(path, rgb);
+}
+
+bool saveBaseline(const std::string &path, const BASELINE &baseline)
+{
+    FILE *file = fopen(path.c_str(), "w");
+    if(!file)
+        return false;
+
+    bool ok = fprintf(file, "revision %s\nconfig %s\n", baseline.revision.c_str(), baseline.config.c_str()) >= 0;
+    for(auto &scene : baseline.frame_ms)
+        ok = ok && fprintf(file, "scene %s %.4f\n", scene.first.c_str(), scene.second) >= 0;
+
+    return fclose(file) == 0 && ok;
+}
+
+bool loadBaseline(const std::string &path, BASELINE &baseline)
+{
+    FILE *file = fopen(path.c_str(), "r");
+    if(!file)
+        return false;
+
+    baseline = BASELINE();
+
+    char line[512];
+    while(fgets(line, sizeof(line), file))
+    {
+        line[strcspn(line, "\n")] = 0;
+
+        char name[256];
+        double ms;
+        if(strncmp(line, "revision ", 9) == 0)
+            baseline.revision = line + 9;
+        else if(strncmp(line, "config ", 7) == 0)
+            baseline.config = line + 7;
+        else if(sscanf(line, "scene %255s %lf", name, &ms) == 2)
+            baseline.frame_ms[name] = ms;
+    }
+
+    fclose(file);
+    return true;
+}
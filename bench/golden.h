@@ -0,0 +1,44 @@
+#ifndef GOLDEN_H
+#define GOLDEN_H
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "gl.h"
+
+/* Reference images and timings for catching regressions with the benchmark scenes.
+ * A golden image is stored as PATH.ppm with the colours and PATH.depth.pgm with the 16-bit depth buffer,
+ * so that both can be looked at with an image viewer. */
+
+struct GOLDEN_IMAGE {
+    std::vector<COLOR> color;
+    std::vector<uint16_t> depth;
+};
+
+struct GOLDEN_DIFF {
+    //Pixels differing by more than the tolerance and the largest difference of any pixel.
+    //Colours are compared per channel, expanded to 8 bits.
+    unsigned int color_pixels, max_color;
+    unsigned int depth_pixels, max_depth;
+};
+
+//Copies frame and the current depth buffer
+void captureGolden(GOLDEN_IMAGE &image, const COLOR *frame);
+bool saveGolden(const std::string &path, const GOLDEN_IMAGE &image);
+bool loadGolden(const std::string &path, GOLDEN_IMAGE &image);
+
+GOLDEN_DIFF compareGolden(const GOLDEN_IMAGE &golden, const GOLDEN_IMAGE &image, const unsigned int color_tolerance, const unsigned int depth_tolerance);
+//Writes a PPM with the golden image darkened, pixels with a different colour in red and with only a different depth in yellow
+bool saveGoldenDiff(const std::string &path, const GOLDEN_IMAGE &golden, const GOLDEN_IMAGE &image, const unsigned int color_tolerance, const unsigned int depth_tolerance);
+
+//Median frame time in ms of each scene, recorded together with the revision and the enabled options
+struct BASELINE {
+    std::string revision, config;
+    std::map<std::string, double> frame_ms;
+};
+
+bool saveBaseline(const std::string &path, const BASELINE &baseline);
+bool loadBaseline(const std::string &path, BASELINE &baseline);
+
+#endif // GOLDEN_H
@@ -1,41 +1,253 @@
-#include <cmath>
-
-#include "fix.h"
-#include "fastmath.h"
-
-#define pi 3.14159265
-
-#define LUT_SIZE ((FFix(360+90).value)+1)
-
-static FFix *table_sin;
-
-void init_fastmath()
-{	
-    table_sin = new FFix[LUT_SIZE];
-
-    float incr = (1.0 / (1<<FFix::precision)) * (pi/180);
-
-    FFix deg = 0;
-    float rad = 0;
-    while(deg.value < LUT_SIZE)
-	{
-        table_sin[deg.value].fromFloat(sinf(rad));
-        deg.value++;
-        rad += incr;
-	}
-}
-
-void uninit_fastmath()
-{
-    delete[] table_sin;
-}
-
-FFix fast_sin(FFix deg)
-{	
-    return table_sin[deg.value];
-}
-
-FFix fast_cos(FFix deg)
-{	
-    return table_sin[deg.value + FFix(90).value];
-}
+#include "fix.h"
+#include "fastmath.h"
+
+/* All tables are computed by the compiler and end up in .rodata,
+ * so there's nothing to initialize at runtime and they're small enough
+ * to stay in the cache (about 2 KiB together). */
+
+static_assert(FFix::precision == 8, "The table lookups assume 8 fractional bits");
+
+#define pi 3.14159265358979323846
+
+//A C++11 replacement for std::index_sequence
+template <unsigned int... I> struct Indices {};
+template <unsigned int N, unsigned int... I> struct MakeIndices : MakeIndices<N - 1, N - 1, I...> {};
+template <unsigned int... I> struct MakeIndices<0, I...> { typedef Indices<I...> type; };
+
+template <unsigned int N> struct Table { uint16_t data[N]; };
+
+template <typename F, unsigned int... I>
+constexpr Table<sizeof...(I)> makeTable(F f, Indices<I...>)
+{
+    return {{ f(I)... }};
+}
+
+constexpr uint16_t round16(const double x) { return static_cast<uint16_t>(x + 0.5); }
+
+//Taylor series, only used with |x| <= pi/2
+constexpr double sinTerms(const double x2, const double term, const unsigned int n)
+{
+    return n > 12 ? term : term + sinTerms(x2, -term * x2 / ((2*n) * (2*n + 1)), n + 1);
+}
+
+constexpr double constSin(const double x) { return sinTerms(x * x, x, 1); }
+
+//Taylor series, only used with |x| <= tan(22.5°)
+constexpr double atanTerms(const double x2, const double term, const unsigned int n)
+{
+    return n > 24 ? term / (2*n + 1) : term / (2*n + 1) + atanTerms(x2, -term * x2, n + 1);
+}
+
+//atan(x) = pi/4 + atan((x-1)/(x+1)) reduces [tan(22.5°), 1] to [-tan(22.5°), 0]
+constexpr double constAtan(const double x)
+{
+    return x <= 0.4142135623730950 ? atanTerms(x * x, x, 0)
+                                    : pi/4 + atanTerms(((x-1)/(x+1)) * ((x-1)/(x+1)), (x-1)/(x+1), 0);
+}
+
+constexpr double constSqrtNewton(const double x, const double guess, const unsigned int n)
+{
+    return n == 0 ? guess : constSqrtNewton(x, (guess + x / guess) / 2, n - 1);
+}
+
+constexpr double constSqrt(const double x) { return constSqrtNewton(x, x, 24); }
+
+/* Quarter wave of sin in Q15, SIN_STEPS_PER_DEGREE entries per degree.
+ * It goes one entry past 90° so that interpolation never reads past the end. */
+#define SIN_STEPS_PER_DEGREE 4
+#define SIN_STEP_SHIFT 6 // log2(256 / SIN_STEPS_PER_DEGREE)
+#define SIN_TABLE_SIZE (90 * SIN_STEPS_PER_DEGREE + 2)
+
+constexpr uint16_t sinEntry(const unsigned int i) { return round16(constSin(i * (pi / 180 / SIN_STEPS_PER_DEGREE)) * 32768); }
+
+static constexpr Table<SIN_TABLE_SIZE> sin_table = makeTable(sinEntry, MakeIndices<SIN_TABLE_SIZE>::type());
+
+//atan(i/256) in degrees, FFix
+#define ATAN_TABLE_SIZE (256 + 1)
+
+constexpr uint16_t atanEntry(const unsigned int i) { return round16(constAtan(i / 256.0) * (180 / pi) * 256); }
+
+static constexpr Table<ATAN_TABLE_SIZE> atan_table = makeTable(atanEntry, MakeIndices<ATAN_TABLE_SIZE>::type());
+
+//sqrt((64 + i) * 256) in Q7, covers mantissas in [2^14, 2^16]
+#define SQRT_TABLE_SIZE (192 + 1)
+
+constexpr uint16_t sqrtEntry(const unsigned int i) { return round16(constSqrt((64 + i) * 256.0) * 128); }
+
+static constexpr Table<SQRT_TABLE_SIZE> sqrt_table = makeTable(sqrtEntry, MakeIndices<SQRT_TABLE_SIZE>::type());
+
+//2^23 / (256 + i), covers mantissas in [2^15, 2^16]
+#define RECIP_TABLE_SIZE (256 + 1)
+
+constexpr uint16_t recipEntry(const unsigned int i) { return round16(8388608.0 / (256 + i)); }
+
+static constexpr Table<RECIP_TABLE_SIZE> recip_table = makeTable(recipEntry, MakeIndices<RECIP_TABLE_SIZE>::type());
+
+//Linear interpolation between table[i] and table[i+1], frac has the given amount of bits
+static inline int32_t lerp(const uint16_t *table, const unsigned int i, const unsigned int frac, const unsigned int bits)
+{
+    return table[i] + ((int32_t(table[i + 1] - table[i]) * int32_t(frac)) >> bits);
+}
+
+void init_fastmath()
+{
+}
+
+void uninit_fastmath()
+{
+}
+
+//pos is in 1/256 degrees, [0, 90°]
+static inline int32_t quarterSin(const uint32_t pos)
+{
+    #ifdef FASTMATH_INTERPOLATE
+        const int32_t q15 = lerp(sin_table.data, pos >> SIN_STEP_SHIFT, pos & ((1 << SIN_STEP_SHIFT) - 1), SIN_STEP_SHIFT);
+    #else
+        const int32_t q15 = sin_table.data[(pos + (1 << (SIN_STEP_SHIFT - 1))) >> SIN_STEP_SHIFT];
+    #endif
+
+    return (q15 + (1 << 6)) >> 7;
+}
+
+static inline int32_t normaliseAngle(int32_t value)
+{
+    constexpr int32_t full = 360 << 8;
+    if(value < 0)
+        value += full;
+    else if(value >= full)
+        value -= full;
+
+    return value;
+}
+
+//value is in [0, 360°)
+static inline int32_t sinValue(const int32_t value)
+{
+    constexpr int32_t quarter = 90 << 8;
+    if(value < quarter)
+        return quarterSin(value);
+    else if(value < 2 * quarter)
+        return quarterSin(2 * quarter - value);
+    else if(value < 3 * quarter)
+        return -quarterSin(value - 2 * quarter);
+    else
+        return -quarterSin(4 * quarter - value);
+}
+
+FFix fast_sin(FFix deg)
+{
+    FFix ret;
+    ret.value = sinValue(normaliseAngle(deg.value));
+    return ret;
+}
+
+FFix fast_cos(FFix deg)
+{
+    FFix ret;
+    ret.value = sinValue(normaliseAngle(normaliseAngle(deg.value) + (90 << 8)));
+    return ret;
+}
+
+void fast_sincos(FFix deg, FFix &sin, FFix &cos)
+{
+    constexpr int32_t quarter = 90 << 8;
+    const int32_t value = normaliseAngle(deg.value);
+
+    //Reduce to the first quadrant, then sin and cos are just swapped and/or negated
+    const int32_t quadrant = value / quarter, pos = value - quadrant * quarter;
+    const int32_t s = quarterSin(pos), c = quarterSin(quarter - pos);
+
+    switch(quadrant)
+    {
+    case 0:
+        sin.value = s;
+        cos.value = c;
+        break;
+    case 1:
+        sin.value = c;
+        cos.value = -s;
+        break;
+    case 2:
+        sin.value = -s;
+        cos.value = -c;
+        break;
+    default:
+        sin.value = -c;
+        cos.value = s;
+        break;
+    }
+}
+
+FFix fast_atan2(FFix y, FFix x)
+{
+    const uint32_t ax = x.value < 0 ? -x.value : x.value, ay = y.value < 0 ? -y.value : y.value;
+
+    FFix ret;
+    if(ax == 0 && ay == 0)
+    {
+        ret.value = 0;
+        return ret;
+    }
+
+    //First octant: atan(min/max) with the ratio in Q16
+    const uint32_t lo = ax < ay ? ax : ay, hi = ax < ay ? ay : ax;
+    const uint32_t ratio = (uint64_t(lo) << 16) / hi;
+    int32_t angle = ratio >= (1u << 16) ? atan_table.data[ATAN_TABLE_SIZE - 1] : lerp(atan_table.data, ratio >> 8, ratio & 0xFF, 8);
+
+    if(ay > ax)
+        angle = (90 << 8) - angle;
+    if(x.value < 0)
+        angle = (180 << 8) - angle;
+    if(y.value < 0 && angle != 0)
+        angle = (360 << 8) - angle;
+
+    ret.value = angle;
+    return ret;
+}
+
+FFix fast_sqrt(FFix x)
+{
+    FFix ret;
+    if(x.value <= 0)
+    {
+        ret.value = 0;
+        return ret;
+    }
+
+    /* sqrt(value / 256) * 256 = sqrt(value) * 16.
+     * Normalise value to m * 2^shift with m in [2^14, 2^16) and an even shift. */
+    const uint32_t value = x.value;
+    const int bits = 32 - __builtin_clz(value);
+    const int shift = (bits - 15) & ~1;
+    const uint32_t m = shift >= 0 ? value >> shift : value << -shift;
+
+    //The table is in Q7, so the result needs another factor of 16 / 128
+    const uint32_t root = lerp(sqrt_table.data, (m >> 8) - 64, m & 0xFF, 8);
+    const int out_shift = shift / 2 - 3;
+    ret.value = out_shift >= 0 ? root << out_shift : (root + (1 << (-out_shift - 1))) >> -out_shift;
+    return ret;
+}
+
+FFix fast_recip(FFix x)
+{
+    FFix ret;
+    if(x.value == 0)
+    {
+        ret = FFix::maxValue();
+        return ret;
+    }
+
+    /* 1 / (value / 256) * 256 = 2^16 / value.
+     * Normalise value to m * 2^shift with m in [2^15, 2^16). */
+    const uint32_t value = x.value < 0 ? -x.value : x.value;
+    const int shift = 32 - __builtin_clz(value) - 16;
+    const uint32_t m = shift >= 0 ? value >> shift : value << -shift;
+
+    //The table contains 2^30 / m, so divide by another 2^(14 + shift)
+    const uint32_t recip = lerp(recip_table.data, (m >> 7) - 256, m & 0x7F, 7);
+    const int out_shift = 14 + shift;
+    const uint32_t result = out_shift >= 0 ? (recip + (1u << out_shift >> 1)) >> out_shift : recip << -out_shift;
+
+    ret.value = x.value < 0 ? -int32_t(result) : int32_t(result);
+    return ret;
+}
@@ -5,9 +5,19 @@
 
 typedef Fix<8, int32_t> FFix;
 
+//The tables are generated at compile time, so these don't do anything anymore
 void init_fastmath();
 void uninit_fastmath();
+
+//Angles are in degrees and have to be in the range [-360, 720)
 FFix fast_sin(FFix deg);
 FFix fast_cos(FFix deg);
+void fast_sincos(FFix deg, FFix &sin, FFix &cos);
+//Returns the angle of the vector (x, y) in degrees, in the range [0, 360)
+FFix fast_atan2(FFix y, FFix x);
+//Returns 0 for negative values
+FFix fast_sqrt(FFix x);
+//Returns the largest possible value for 0
+FFix fast_recip(FFix x);
 
 #endif
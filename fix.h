@@ -7,11 +7,15 @@
 #include <cstring>
 #include <cstdio>
 
-template <unsigned int s, typename T=int_fast32_t> class Fix
-{   
+// W is the type used for intermediate values of multiplications and divisions.
+// A type twice as wide as T avoids overflows, at the cost of slower math on some platforms.
+template <unsigned int s, typename T=int_fast32_t, typename W=T> class Fix
+{
+    static_assert(sizeof(W) >= sizeof(T), "The intermediate type can't be narrower than the storage type");
+
 public:
     constexpr Fix() : value(0) {}
-    template <unsigned int s2, typename T2> Fix(const Fix<s2, T2> f) : value((s2 > s) ? (f.value >> (s2 - s)) : (f.value << (s-s2))) {}
+    template <unsigned int s2, typename T2, typename W2> Fix(const Fix<s2, T2, W2> f) : value((s2 > s) ? (f.value >> (s2 - s)) : (f.value << (s-s2))) {}
     constexpr Fix(const float v) : value(static_cast<T>(v * static_cast<float>(1<<s))) {}
     constexpr Fix(const unsigned int v) : value(v << s) {}
     constexpr Fix(const int v) : value(static_cast<unsigned int>(v) << s) {}
@@ -24,45 +28,45 @@ public:
     T round() const { T ret = value >> (s-1); return (ret>>1) + (ret&1); }
     constexpr T floor() const { return value >> s; }
 
-    Fix<s,T> wholes() const { Fix<s,T> ret; ret.value = value & ~((1<<s)-1); return ret; }
+    Fix<s,T,W> wholes() const { Fix<s,T,W> ret; ret.value = value & ~((1<<s)-1); return ret; }
 
-    Fix<s,T> operator -() const { Fix<s,T> ret; ret.value = -value; return ret; }
-    Fix<s,T>& operator +() const { return *this; }
+    Fix<s,T,W> operator -() const { Fix<s,T,W> ret; ret.value = -value; return ret; }
+    Fix<s,T,W>& operator +() const { return *this; }
 
-    Fix<s,T>& operator ++() { value += 1 << s; return *this; }
-    Fix<s,T>& operator --() { value -= 1 << s; return *this; }
+    Fix<s,T,W>& operator ++() { value += 1 << s; return *this; }
+    Fix<s,T,W>& operator --() { value -= 1 << s; return *this; }
 
-    template <typename U> Fix<s,T> operator >>(const U other) const { Fix<s,T> ret; ret.value = value >> other; return ret; }
-    template <typename U> Fix<s,T> operator <<(const U other) const { Fix<s,T> ret; ret.value = value << other; return ret; }
+    template <typename U> Fix<s,T,W> operator >>(const U other) const { Fix<s,T,W> ret; ret.value = value >> other; return ret; }
+    template <typename U> Fix<s,T,W> operator <<(const U other) const { Fix<s,T,W> ret; ret.value = value << other; return ret; }
 
-    Fix<s,T> operator +(const Fix<s,T>& other) const { Fix<s,T> ret; ret.value = value + other.value; return ret; }
-    template <typename U> Fix<s,T> operator +(const U other) const { Fix<s,T> ret; ret.value = value + (other<<s); return ret; }
+    Fix<s,T,W> operator +(const Fix<s,T,W>& other) const { Fix<s,T,W> ret; ret.value = value + other.value; return ret; }
+    template <typename U> Fix<s,T,W> operator +(const U other) const { Fix<s,T,W> ret; ret.value = value + (other<<s); return ret; }
 
-    Fix<s,T> operator -(const Fix<s,T>& other) const { Fix<s,T> ret; ret.value = value - other.value; return ret; }
-    template <typename U> Fix<s,T> operator -(const U other) const { Fix<s,T> ret; ret.value = value - (other<<s); return ret; }
+    Fix<s,T,W> operator -(const Fix<s,T,W>& other) const { Fix<s,T,W> ret; ret.value = value - other.value; return ret; }
+    template <typename U> Fix<s,T,W> operator -(const U other) const { Fix<s,T,W> ret; ret.value = value - (other<<s); return ret; }
 
-    template <unsigned int s2, typename T2> Fix<s,T> operator *(const Fix<s2,T2>& other) const { Fix<s,T> ret; ret.value = (value * other.value) >> s2; return ret; }
-    template <typename U> Fix<s,T> operator *(const U other) const { Fix<s,T> ret; ret.value = value * other; return ret; }
+    template <unsigned int s2, typename T2, typename W2> Fix<s,T,W> operator *(const Fix<s2,T2,W2>& other) const { Fix<s,T,W> ret; ret.value = (static_cast<W>(value) * other.value) >> s2; return ret; }
+    template <typename U> Fix<s,T,W> operator *(const U other) const { Fix<s,T,W> ret; ret.value = value * other; return ret; }
 
-    Fix<s,T> operator /(const Fix<s,T>& other) const { Fix<s,T> ret; ret.value = (value << s) / other.value; return ret; }
-    template <typename U> Fix<s,T> operator /(const U other) const { Fix<s,T> ret; ret.value = value / other; return ret; }
+    Fix<s,T,W> operator /(const Fix<s,T,W>& other) const { Fix<s,T,W> ret; ret.value = (static_cast<W>(value) << s) / other.value; return ret; }
+    template <typename U> Fix<s,T,W> operator /(const U other) const { Fix<s,T,W> ret; ret.value = value / other; return ret; }
 
-    Fix<s,T>& operator +=(const Fix<s,T>& other) { value += other.value; return *this; }
-    Fix<s,T>& operator -=(const Fix<s,T>& other) { value -= other.value; return *this; }
-    Fix<s,T>& operator *=(const float other) { value *= other; return *this; }
-    Fix<s,T>& operator *=(const int other) { value *= other; return *this; }
-    Fix<s,T>& operator *=(const Fix<s,T>& other) { value = (value * other.value) >> s; return *this; }
-    Fix<s,T>& operator /=(const float other) { value /= other; return *this; }
-    Fix<s,T>& operator /=(const int other) { value /= other; return *this; }
-    Fix<s,T>& operator /=(const Fix<s,T>& other) { value = (value << s) / other.value; return *this; }
+    Fix<s,T,W>& operator +=(const Fix<s,T,W>& other) { value += other.value; return *this; }
+    Fix<s,T,W>& operator -=(const Fix<s,T,W>& other) { value -= other.value; return *this; }
+    Fix<s,T,W>& operator *=(const float other) { value *= other; return *this; }
+    Fix<s,T,W>& operator *=(const int other) { value *= other; return *this; }
+    Fix<s,T,W>& operator *=(const Fix<s,T,W>& other) { value = (static_cast<W>(value) * other.value) >> s; return *this; }
+    Fix<s,T,W>& operator /=(const float other) { value /= other; return *this; }
+    Fix<s,T,W>& operator /=(const int other) { value /= other; return *this; }
+    Fix<s,T,W>& operator /=(const Fix<s,T,W>& other) { value = (static_cast<W>(value) << s) / other.value; return *this; }
 
-    constexpr bool operator >(const Fix<s,T>& other) const { return value > other.value; }
-    constexpr bool operator <(const Fix<s,T>& other) const { return value < other.value; }
+    constexpr bool operator >(const Fix<s,T,W>& other) const { return value > other.value; }
+    constexpr bool operator <(const Fix<s,T,W>& other) const { return value < other.value; }
     template <typename U> constexpr bool operator >=(const U other) const { return value >= other<<s; }
-    constexpr bool operator >=(const Fix<s,T>& other) const { return value >= other.value; }
-    constexpr bool operator <=(const Fix<s,T>& other) const { return value <= other.value; }
-    constexpr bool operator ==(const Fix<s,T>& other) const { return value == other.value; }
-    constexpr bool operator !=(const Fix<s,T>& other) const { return value != other.value; }
+    constexpr bool operator >=(const Fix<s,T,W>& other) const { return value >= other.value; }
+    constexpr bool operator <=(const Fix<s,T,W>& other) const { return value <= other.value; }
+    constexpr bool operator ==(const Fix<s,T,W>& other) const { return value == other.value; }
+    constexpr bool operator !=(const Fix<s,T,W>& other) const { return value != other.value; }
 
     template <typename U>
     constexpr U toInteger() const
@@ -86,34 +90,34 @@ public:
         value = static_cast<T>(v * static_cast<float>(1<<s));
     }
 
-    Fix<s,T>& normaliseAngle()
+    Fix<s,T,W>& normaliseAngle()
     {
-        while(*this < Fix<s,T>(0))
-            *this += Fix<s,T>(360);
+        while(*this < Fix<s,T,W>(0))
+            *this += Fix<s,T,W>(360);
 
         while(*this >= 360)
-            *this -= Fix<s,T>(360);
+            *this -= Fix<s,T,W>(360);
 
         return *this;
     }
 
-    static Fix<s,T> minStep()
+    static Fix<s,T,W> minStep()
     {
-        Fix<s,T> ret;
+        Fix<s,T,W> ret;
         ret.value = 1;
         return ret;
     }
 
-    static Fix<s,T> minValue()
+    static Fix<s,T,W> minValue()
     {
-        Fix<s,T> ret;
+        Fix<s,T,W> ret;
         ret.value = std::numeric_limits<T>::min();
         return ret;
     }
 
-    static Fix<s,T> maxValue()
+    static Fix<s,T,W> maxValue()
     {
-        Fix<s,T> ret;
+        Fix<s,T,W> ret;
         ret.value = std::numeric_limits<T>::max();
         return ret;
     }
@@ -178,6 +182,7 @@ public:
     }
 
     using type = T;
+    using wide_type = W;
     constexpr static unsigned int precision = s;
 
     T value;
@@ -0,0 +1,305 @@
+#include <algorithm>
+#include <cstdio>
+#include <ctime>
+#include <string>
+#include <vector>
+
+#ifndef _TINSPIRE
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#endif
+
+#include "framecapture.h"
+
+static CAPTURE_FORMAT capture_format;
+static std::string capture_path;
+static FILE *stream, *timestamps;
+static std::vector<uint8_t> converted; //Used by the writer only
+static FRAME_CAPTURE_STATS stats;
+static unsigned int next_number;
+static bool capturing = false, write_failed;
+
+#ifndef _TINSPIRE
+    static std::chrono::steady_clock::time_point start;
+#else
+    static clock_t start;
+#endif
+
+static unsigned long long microsecondsSinceStart()
+{
+    #ifndef _TINSPIRE
+        return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+    #else
+        return (clock() - start) * 1000000ull / CLOCKS_PER_SEC;
+    #endif
+}
+
+static inline void expand(const COLOR c, unsigned int &r, unsigned int &g, unsigned int &b)
+{
+    r = c >> 11;
+    g = (c >> 5) & 0x3F;
+    b = c & 0x1F;
+    r = r << 3 | r >> 2;
+    g = g << 2 | g >> 4;
+    b = b << 3 | b >> 2;
+}
+
+static bool writeY4M(const COLOR *pixels, FILE *file)
+{
+    const unsigned int size = SCREEN_WIDTH*SCREEN_HEIGHT;
+    converted.resize(size * 3);
+    uint8_t *y = converted.data(), *u = y + size, *v = u + size;
+    for(unsigned int i = 0; i < size; ++i)
+    {
+        unsigned int r, g, b;
+        expand(pixels[i], r, g, b);
+        //BT.601 with the limited range, which Y4M assumes
+        y[i] = ((66*r + 129*g + 25*b + 128) >> 8) + 16;
+        u[i] = ((-38*int(r) - 74*int(g) + 112*int(b) + 128) >> 8) + 128;
+        v[i] = ((112*int(r) - 94*int(g) - 18*int(b) + 128) >> 8) + 128;
+    }
+
+    return fputs("FRAME\n", file) >= 0 && fwrite(converted.data(), converted.size(), 1, file) == 1;
+}
+
+static bool writePPM(const COLOR *pixels, const unsigned int number)
+{
+    char filename[512];
+    snprintf(filename, sizeof(filename), capture_path.c_str(), number);
+
+    FILE *file = fopen(filename, "wb");
+    if(!file)
+        return false;
+
+    converted.resize(SCREEN_WIDTH*SCREEN_HEIGHT*3);
+    uint8_t *rgb = converted.data();
+    for(unsigned int i = 0; i < SCREEN_WIDTH*SCREEN_HEIGHT; ++i)
+    {
+        unsigned int r, g, b;
+        expand(pixels[i], r, g, b);
+        *rgb++ = r;
+        *rgb++ = g;
+        *rgb++ = b;
+    }
+
+    const bool ok = fprintf(file, "P6 %d %d %d ", SCREEN_WIDTH, SCREEN_HEIGHT, 255) >= 0
+            && fwrite(converted.data(), converted.size(), 1, file) == 1;
+    return fclose(file) == 0 && ok;
+}
+
+//Only called by one thread at a time
+static void writeFrame(const COLOR *pixels, const unsigned int number, const unsigned long long time_us)
+{
+    if(write_failed)
+        return;
+
+    bool ok;
+    switch(capture_format)
+    {
+    case CAPTURE_RAW:
+        ok = fwrite(pixels, sizeof(COLOR) * SCREEN_WIDTH*SCREEN_HEIGHT, 1, stream) == 1;
+        break;
+    case CAPTURE_Y4M:
+        ok = writeY4M(pixels, stream);
+        break;
+    default:
+        ok = writePPM(pixels, number);
+        break;
+    }
+
+    if(ok && timestamps)
+        ok = fprintf(timestamps, "%u %llu\n", number, time_us) >= 0;
+
+    if(!ok)
+    {
+        printf("Couldn't write frame %u, stopping the capture.\n", number);
+        write_failed = true;
+    }
+}
+
+#ifndef _TINSPIRE
+
+struct CaptureBuffer {
+    COLOR *pixels;
+    unsigned int number;
+    unsigned long long time_us;
+};
+
+static std::vector<CaptureBuffer> buffers;
+static std::thread writer;
+static std::mutex capture_mutex;
+static std::condition_variable capture_condition;
+static std::deque<CaptureBuffer*> free_buffers, full_buffers;
+static bool stopping;
+
+static void writerThread()
+{
+    std::unique_lock<std::mutex> lock(capture_mutex);
+    for(;;)
+    {
+        capture_condition.wait(lock, []{ return stopping || !full_buffers.empty(); });
+        if(full_buffers.empty())
+            return;
+
+        CaptureBuffer *buffer = full_buffers.front();
+        full_buffers.pop_front();
+
+        lock.unlock();
+        writeFrame(buffer->pixels, buffer->number, buffer->time_us);
+        lock.lock();
+
+        if(!write_failed)
+            ++stats.written;
+
+        free_buffers.push_back(buffer);
+    }
+}
+
+//The only work on the rendering thread: A copy of the frame
+static void displayHook(const COLOR *frame)
+{
+    const unsigned int number = next_number++;
+
+    CaptureBuffer *buffer;
+    {
+        std::lock_guard<std::mutex> lock(capture_mutex);
+        if(free_buffers.empty())
+        {
+            ++stats.dropped;
+            return;
+        }
+
+        buffer = free_buffers.front();
+        free_buffers.pop_front();
+    }
+
+    buffer->number = number;
+    buffer->time_us = microsecondsSinceStart();
+    std::copy(frame, frame + SCREEN_WIDTH*SCREEN_HEIGHT, buffer->pixels);
+
+    {
+        std::lock_guard<std::mutex> lock(capture_mutex);
+        full_buffers.push_back(buffer);
+        ++stats.captured;
+    }
+
+    capture_condition.notify_one();
+}
+
+#else
+
+static void displayHook(const COLOR *frame)
+{
+    ++stats.captured;
+    writeFrame(frame, next_number++, microsecondsSinceStart());
+    if(!write_failed)
+        ++stats.written;
+}
+
+#endif
+
+bool frameCaptureStart(const char *path, const CAPTURE_FORMAT format, const char *timestamps_path, const unsigned int buffer_count, const unsigned int fps)
+{
+    if(capturing)
+        frameCaptureStop();
+
+    capture_format = format;
+    capture_path = path;
+    stream = timestamps = nullptr;
+
+    if(format != CAPTURE_PPM)
+    {
+        stream = fopen(path, "wb");
+        if(!stream)
+            return false;
+
+        if(format == CAPTURE_Y4M && fprintf(stream, "YUV4MPEG2 W%d H%d F%u:1 Ip A1:1 C444\n", SCREEN_WIDTH, SCREEN_HEIGHT, fps) < 0)
+        {
+            fclose(stream);
+            return false;
+        }
+    }
+
+    if(timestamps_path)
+    {
+        timestamps = fopen(timestamps_path, "w");
+        if(!timestamps)
+        {
+            if(stream)
+                fclose(stream);
+
+            return false;
+        }
+    }
+
+    stats = FRAME_CAPTURE_STATS();
+    next_number = 0;
+    write_failed = false;
+
+    #ifndef _TINSPIRE
+        start = std::chrono::steady_clock::now();
+
+        buffers.resize(std::max(1u, buffer_count));
+        for(CaptureBuffer &buffer : buffers)
+        {
+            buffer.pixels = new COLOR[SCREEN_WIDTH*SCREEN_HEIGHT];
+            free_buffers.push_back(&buffer);
+        }
+
+        stopping = false;
+        writer = std::thread(writerThread);
+    #else
+        (void) buffer_count;
+        start = clock();
+    #endif
+
+    capturing = true;
+    nglSetDisplayHook(displayHook);
+    return true;
+}
+
+void frameCaptureStop()
+{
+    if(!capturing)
+        return;
+
+    nglSetDisplayHook(nullptr);
+
+    #ifndef _TINSPIRE
+        {
+            std::lock_guard<std::mutex> lock(capture_mutex);
+            stopping = true;
+        }
+
+        capture_condition.notify_one();
+        writer.join();
+
+        free_buffers.clear();
+        for(CaptureBuffer &buffer : buffers)
+            delete[] buffer.pixels;
+
+        buffers.clear();
+    #endif
+
+    converted.clear();
+    converted.shrink_to_fit();
+
+    if(stream)
+        fclose(stream);
+    if(timestamps)
+        fclose(timestamps);
+
+    stream = timestamps = nullptr;
+    capturing = false;
+}
+
+FRAME_CAPTURE_STATS frameCaptureStats()
+{
+    #ifndef _TINSPIRE
+        std::lock_guard<std::mutex> lock(capture_mutex);
+    #endif
+    return stats;
+}
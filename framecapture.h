@@ -0,0 +1,31 @@
+#ifndef FRAMECAPTURE_H
+#define FRAMECAPTURE_H
+
+#include "gl.h"
+
+/* Captures the frames shown by nglDisplay without stalling the rendering:
+ * Each frame is copied into a free buffer of a ring and written by a background thread.
+ * If all buffers are still waiting to be written, the frame is dropped instead of waiting.
+ * The calculator doesn't have threads, so there each frame is written in nglDisplay. */
+
+enum CAPTURE_FORMAT {
+    CAPTURE_RAW = 0, //RGB565 little endian frames, one after another
+    CAPTURE_Y4M, //YUV4MPEG2 stream, 4:4:4 BT.601
+    CAPTURE_PPM //One file per frame, path is a printf pattern for the frame number like "frame%05u.ppm"
+};
+
+struct FRAME_CAPTURE_STATS {
+    unsigned int captured, written, dropped;
+};
+
+/* Installs the display hook with nglDisplay. Frames are numbered from 0 in the order they're displayed,
+ * so dropped ones leave gaps. If timestamps_path isn't nullptr, a line with the number of each
+ * written frame and the microseconds since the start is written into it.
+ * fps only ends up in the Y4M header, the timestamps have the real ones.
+ * Returns false if a file couldn't be opened. */
+bool frameCaptureStart(const char *path, const CAPTURE_FORMAT format, const char *timestamps_path = nullptr, const unsigned int buffers = 4, const unsigned int fps = 30);
+//Writes the remaining frames and closes the files
+void frameCaptureStop();
+FRAME_CAPTURE_STATS frameCaptureStats();
+
+#endif // FRAMECAPTURE_H
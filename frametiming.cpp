@@ -0,0 +1,180 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#ifndef _TINSPIRE
+#include <chrono>
+#else
+#include <ctime>
+#endif
+
+#include "frametiming.h"
+
+#ifdef FRAME_TIMING
+
+//The last FRAME_TIMING_HISTORY durations of frames or one marker
+struct TIMING_HISTORY {
+    const char *name;
+    unsigned int count; //Of all recorded durations
+    uint32_t durations[FRAME_TIMING_HISTORY];
+    uint32_t worst_ever;
+    unsigned int worst_ever_frame;
+};
+
+static TIMING_HISTORY frames, markers[FRAME_TIMING_MARKERS];
+static unsigned int marker_count = 0, frame_number = 0;
+static bool displayed = false, marked = false; //Whether last_display and last_mark are set
+static uint64_t last_display, last_mark;
+
+static uint64_t microseconds()
+{
+    #ifndef _TINSPIRE
+        return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    #else
+        return uint64_t(clock()) * 1000000u / CLOCKS_PER_SEC;
+    #endif
+}
+
+static void record(TIMING_HISTORY &history, const uint32_t duration)
+{
+    history.durations[history.count++ % FRAME_TIMING_HISTORY] = duration;
+    if(duration > history.worst_ever)
+    {
+        history.worst_ever = duration;
+        history.worst_ever_frame = frame_number;
+    }
+}
+
+void frameTimingDisplay()
+{
+    const uint64_t now = microseconds();
+    if(displayed)
+        record(frames, now - last_display);
+
+    displayed = marked = true;
+    last_display = last_mark = now;
+    ++frame_number;
+}
+
+void frameTimingMark(const char *name)
+{
+    const uint64_t now = microseconds();
+    if(!marked)
+    {
+        //Nothing to measure from yet
+        marked = true;
+        last_mark = now;
+        return;
+    }
+
+    TIMING_HISTORY *marker = std::find_if(markers, markers + marker_count, [name](const TIMING_HISTORY &m) { return strcmp(m.name, name) == 0; });
+    if(marker == markers + marker_count)
+    {
+        if(marker_count == FRAME_TIMING_MARKERS)
+        {
+            last_mark = now;
+            return;
+        }
+
+        marker->name = name;
+        ++marker_count;
+    }
+
+    record(*marker, now - last_mark);
+    last_mark = now;
+}
+
+//Nearest rank, sorted has to be sorted
+static uint32_t percentile(const uint32_t *sorted, const unsigned int count, const unsigned int p)
+{
+    const unsigned int rank = (count * p + 99) / 100;
+    return sorted[std::max(rank, 1u) - 1];
+}
+
+FRAME_TIMES frameTimes(const char *marker)
+{
+    const TIMING_HISTORY *history = &frames;
+    if(marker)
+    {
+        history = std::find_if(markers, markers + marker_count, [marker](const TIMING_HISTORY &m) { return strcmp(m.name, marker) == 0; });
+        if(history == markers + marker_count)
+            return FRAME_TIMES();
+    }
+
+    FRAME_TIMES times = FRAME_TIMES();
+    times.samples = std::min(history->count, unsigned(FRAME_TIMING_HISTORY));
+    if(times.samples == 0)
+        return times;
+
+    uint32_t sorted[FRAME_TIMING_HISTORY];
+    std::copy(history->durations, history->durations + times.samples, sorted);
+    std::sort(sorted, sorted + times.samples);
+
+    uint64_t total = 0;
+    for(unsigned int i = 0; i < times.samples; ++i)
+        total += sorted[i];
+
+    times.last = history->durations[(history->count - 1) % FRAME_TIMING_HISTORY];
+    times.mean = total / times.samples;
+    times.p50 = percentile(sorted, times.samples, 50);
+    times.p95 = percentile(sorted, times.samples, 95);
+    times.p99 = percentile(sorted, times.samples, 99);
+    times.worst = sorted[times.samples - 1];
+    times.worst_ever = history->worst_ever;
+    times.worst_ever_frame = history->worst_ever_frame;
+    return times;
+}
+
+void frameTimingReset()
+{
+    frames = TIMING_HISTORY();
+    std::fill(markers, markers + FRAME_TIMING_MARKERS, TIMING_HISTORY());
+    marker_count = 0;
+    frame_number = 0;
+    displayed = marked = false;
+}
+
+void drawFrameTimingGraph(TEXTURE &dest, const unsigned int x, const unsigned int y, unsigned int w, unsigned int h, const uint32_t budget_us)
+{
+    if(dest.format != TEXTURE_RGB565)
+    {
+        puts("Error: Can't draw into a paletted texture!");
+        return;
+    }
+
+    if(x >= dest.width || y >= dest.height || budget_us == 0)
+        return;
+
+    w = std::min(w, dest.width - x);
+    h = std::min(h, dest.height - y);
+    nglMarkDirty(dest.bitmap, x, y, w, h);
+    #if defined(RENDER_STATS) || defined(OVERDRAW_HEATMAP)
+        for(unsigned int row = 0; row < h; ++row)
+            nglCountWritten(dest.bitmap, dest.bitmap + x + (y + row) * dest.width, w);
+    #endif
+
+    const unsigned int shown = std::min(std::min(frames.count, unsigned(FRAME_TIMING_HISTORY)), w);
+    for(unsigned int column = 0; column < w; ++column)
+    {
+        //The newest frame is on the right
+        const unsigned int age = w - 1 - column;
+        uint32_t duration = 0;
+        if(age < shown)
+            duration = frames.durations[(frames.count - 1 - age) % FRAME_TIMING_HISTORY];
+
+        //The budget is at half the height
+        const unsigned int bar = std::min(uint64_t(h), uint64_t(duration) * h / (2 * uint64_t(budget_us)));
+        const COLOR bar_color = duration <= budget_us ? 0x07E0 : duration <= budget_us + budget_us / 2 ? 0xFFE0 : 0xF800;
+
+        COLOR *pixel = dest.bitmap + x + column + y * dest.width;
+        for(unsigned int row = 0; row < h; ++row, pixel += dest.width)
+        {
+            if(row == h - 1 - h / 2)
+                *pixel = 0xFFFF;
+            else
+                *pixel = row >= h - bar ? bar_color : 0x0000;
+        }
+    }
+}
+
+#endif
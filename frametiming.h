@@ -0,0 +1,44 @@
+#ifndef FRAMETIMING_H
+#define FRAMETIMING_H
+
+#include "gl.h"
+
+/* With FRAME_TIMING, the time between calls to nglDisplay is measured with a monotonic clock
+ * and the last FRAME_TIMING_HISTORY frame times are kept, to find hitches an average FPS hides.
+ * The time of parts of a frame can be measured with frameTimingMark.
+ * The calculator only has clock(), so the resolution is much worse there. */
+
+#ifdef FRAME_TIMING
+
+#ifndef FRAME_TIMING_HISTORY
+    #define FRAME_TIMING_HISTORY 256
+#endif
+#ifndef FRAME_TIMING_MARKERS
+    #define FRAME_TIMING_MARKERS 8
+#endif
+
+//All times in microseconds. Frames are numbered by the nglDisplay calls which end them, starting at 0.
+struct FRAME_TIMES {
+    unsigned int samples; //In the window of the last FRAME_TIMING_HISTORY
+    uint32_t last, mean, p50, p95, p99, worst;
+    //Since the start or frameTimingReset
+    uint32_t worst_ever;
+    unsigned int worst_ever_frame;
+};
+
+//Called by nglDisplay
+void frameTimingDisplay();
+//Records the time since the last mark or nglDisplay under name, which has to stay valid.
+//Up to FRAME_TIMING_MARKERS names are possible, more are ignored.
+void frameTimingMark(const char *name);
+//Of whole frames if marker is nullptr, otherwise the times recorded by frameTimingMark(marker). Zero if there are none.
+FRAME_TIMES frameTimes(const char *marker = nullptr);
+//Forgets all times and markers
+void frameTimingReset();
+//Draws the last frame times as bars from right to left into the area x/y to x+w/y+h of dest,
+//with a white line at budget_us at half the height. Bars over budget are yellow, over 1.5 times that red.
+void drawFrameTimingGraph(TEXTURE &dest, const unsigned int x, const unsigned int y, unsigned int w, unsigned int h, const uint32_t budget_us = 33333);
+
+#endif
+
+#endif // FRAMETIMING_H
@@ -2,17 +2,29 @@
 #include <utility>
 #include <algorithm>
 
+#include "gl.h"
+#include "fastmath.h"
+#include "gldrawarray.h"
+#include "frametiming.h"
+#include "pixelconvert.h"
+#include "trace.h"
+
 #ifdef _TINSPIRE
 #include <libndls.h>
 #else
+#include <cstdlib>
+#ifndef HEADLESS
 #include <SDL/SDL.h>
-#include <assert.h>
 #include <signal.h>
-static SDL_Surface *scr;
+static SDL_Surface *scr; //nullptr if running headless
+static bool scr_xrgb; //The window is XRGB8888 instead of RGB565
+#endif
+static COLOR *frame_copy; //Receives the displayed frames if there's no RGB565 window
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
 #endif
-
-#include "gl.h"
-#include "fastmath.h"
 
 #define M(m, y, x) (m.data[y][x])
 #define P(m, y, x) (m->data[y][x])
@@ -22,23 +34,158 @@ static COLOR color;
 static GLFix u, v;
 static COLOR *screen;
 static uint16_t *z_buffer;
-static GLFix near_plane = 256;
+static PROJECTION projection;
+//reciprocals[z] is 2^32 / z, rounded up. For Fix<12> numerators of up to 2^20 (focal length of 256)
+//the division with it is exact, for larger ones it may be off by one in the last bit.
+//With WIDE_FIXED_POINT, the numerators have 20 fractional bits, so the error is negligible.
+#define RECIPROCAL_TABLE_SIZE 4096
+static uint32_t *reciprocals;
 static const TEXTURE *texture;
+static NGLBINDTEXTUREHOOK bind_texture_hook;
+static NGLDISPLAYHOOK display_hook;
 static unsigned int vertices_count = 0;
 static VERTEX vertices[4];
 static GLDrawMode draw_mode = GL_TRIANGLES;
 static bool is_monochrome;
 static COLOR *screen_inverted; //For monochrome calcs
+static const COLOR *displayed_frame;
+#ifdef DIRTY_RECTANGLES
+    #define DIRTY_LIST_SIZE MAX_DIRTY_RECTANGLES
+#else
+    //The whole screen is always presented
+    #define DIRTY_LIST_SIZE 1
+#endif
+//x2 and y2 are exclusive
+struct DIRTY_RECT
+{
+    int x1, y1, x2, y2;
+};
+struct DIRTY_LIST
+{
+    bool all;
+    unsigned int count;
+    DIRTY_RECT rects[DIRTY_LIST_SIZE];
+};
+#ifdef DIRTY_RECTANGLES
+    //Changed since the last nglDisplay and during the frame before, which glClear has to undo
+    static DIRTY_LIST dirty_current, dirty_previous;
+    static COLOR clear_color;
+#endif
+#define MAX_BUFFER_ROTATION 3
+static COLOR *rotation_buffers[MAX_BUFFER_ROTATION];
+static unsigned int rotation_count = 0, rotation_index = 0;
+#ifndef _TINSPIRE
+    //The buffers waiting for present_thread and the one it's currently presenting
+    static std::thread present_thread;
+    static std::mutex present_mutex;
+    static std::condition_variable present_condition;
+    static std::deque<const COLOR*> present_queue;
+    static const COLOR *presenting;
+    static bool present_stop;
+#endif
 #ifdef FPS_COUNTER
     volatile unsigned int fps;
 #endif
+#ifdef RENDER_STATS
+    FRAME_STATS frame_stats;
+    static FRAME_STATS last_frame_stats;
+#endif
+#ifdef OVERDRAW_HEATMAP
+    //Per pixel of screen, saturating at 255
+    static uint8_t *overdraw_tests, *overdraw_writes;
+    static NGL_HEATMAP heatmap;
+    static OVERDRAW_STATS overdraw_stats;
+
+    static inline void countOverdraw(uint8_t *counters, const int index)
+    {
+        if(counters[index] != UINT8_MAX)
+            ++counters[index];
+    }
+
+    #define COUNT_OVERDRAW(counters, index) countOverdraw(counters, index)
+#else
+    #define COUNT_OVERDRAW(counters, index) ((void) 0)
+#endif
 static int matrix_stack_left = MATRIX_STACK_SIZE;
+#ifdef LIGHTING
+    struct LIGHT
+    {
+        VECTOR3 direction; //Normalized, in view space
+        GLFix intensity;
+    };
+
+    static bool lighting = false;
+    static GLFix ambient_light = 0;
+    static LIGHT lights[MAX_LIGHTS];
+    static VECTOR3 normal(0, 0, -1);
+#endif
+#ifdef LAZY_CLEAR
+    #define TILE_SHIFT 4
+    #define TILE_SIZE (1 << TILE_SHIFT)
+    #define TILE_COLUMNS ((SCREEN_WIDTH + TILE_SIZE - 1) / TILE_SIZE)
+    #define TILE_ROWS ((SCREEN_HEIGHT + TILE_SIZE - 1) / TILE_SIZE)
+    static_assert(TILE_COLUMNS <= 32, "A row of tiles has to fit into an uint32_t");
+
+    //Bit x of pending_*[y] is set if glClear didn't clear that tile yet
+    static uint32_t pending_color[TILE_ROWS], pending_depth[TILE_ROWS];
+    static COLOR pending_clear_color;
+
+    static void clearTile(const unsigned int row, const unsigned int column, const bool color, const bool depth)
+    {
+        const unsigned int x1 = column * TILE_SIZE, x2 = std::min(x1 + TILE_SIZE, unsigned(SCREEN_WIDTH));
+        const unsigned int y1 = row * TILE_SIZE, y2 = std::min(y1 + TILE_SIZE, unsigned(SCREEN_HEIGHT));
+        for(unsigned int y = y1; y < y2; ++y)
+        {
+            if(color)
+                std::fill(screen + x1 + y*SCREEN_WIDTH, screen + x2 + y*SCREEN_WIDTH, pending_clear_color);
+            if(depth)
+                std::fill(z_buffer + x1 + y*SCREEN_WIDTH, z_buffer + x2 + y*SCREEN_WIDTH, UINT16_MAX);
+        }
+
+        if(color)
+            pending_color[row] &= ~(1u << column);
+        if(depth)
+            pending_depth[row] &= ~(1u << column);
+    }
+
+    //Clears the pending tiles touched by line y from x1 to x2, has to be called before drawing into them
+    static inline void clearTilesOfSpan(const int y, int x1, int x2)
+    {
+        x1 = std::max(x1, 0);
+        x2 = std::min(x2, SCREEN_WIDTH - 1);
+        if(x1 > x2 || y < 0 || y >= SCREEN_HEIGHT)
+            return;
+
+        const unsigned int row = y >> TILE_SHIFT;
+        const uint32_t span = (2u << (x2 >> TILE_SHIFT)) - (1u << (x1 >> TILE_SHIFT));
+        for(uint32_t pending = (pending_color[row] | pending_depth[row]) & span; pending; pending &= pending - 1)
+        {
+            const unsigned int column = __builtin_ctz(pending);
+            clearTile(row, column, pending_color[row] & (1u << column), pending_depth[row] & (1u << column));
+        }
+    }
+
+    //Clears the tiles of the color buffer nothing got drawn into
+    static void clearPendingColor()
+    {
+        for(unsigned int row = 0; row < TILE_ROWS; ++row)
+            for(uint32_t pending = pending_color[row]; pending; pending &= pending - 1)
+                clearTile(row, __builtin_ctz(pending), true, false);
+    }
+#endif
 
 void nglInit()
 {
-    init_fastmath();
     transformation = new MATRIX[MATRIX_STACK_SIZE];
 
+    reciprocals = new uint32_t[RECIPROCAL_TABLE_SIZE];
+    //Only unclipped vertices like those of nglDrawLine3D can be closer than CLIP_PLANE,
+    //treat them as if they were at it so that the products in project() can't overflow
+    for(unsigned int z = 0; z < RECIPROCAL_TABLE_SIZE; ++z)
+        reciprocals[z] = ((uint64_t(1) << 32) + std::max(z, unsigned(CLIP_PLANE)) - 1) / std::max(z, unsigned(CLIP_PLANE));
+
+    nglSetNearPlane(256);
+
     //C++ <3
     z_buffer = new std::remove_reference<decltype(*z_buffer)>::type[SCREEN_WIDTH*SCREEN_HEIGHT];
     glLoadIdentity();
@@ -60,46 +207,124 @@ void nglInit()
         else
             lcd_init(SCR_320x240_565);
     #else
-        SDL_Init(SDL_INIT_VIDEO);
-        scr = SDL_SetVideoMode(SCREEN_WIDTH, SCREEN_HEIGHT, 16, SDL_SWSURFACE);
-        signal(SIGINT, SIG_DFL);
-        assert(scr);
+        bool window_has_frame = false;
+        #ifndef HEADLESS
+            //Setting NGL_HEADLESS renders without a window, which is also the fallback without a display
+            scr = nullptr;
+            if(!getenv("NGL_HEADLESS"))
+            {
+                SDL_Init(SDL_INIT_VIDEO);
+
+                //Convert to the format of the display directly instead of letting SDL do it on each update
+                const SDL_PixelFormat *fmt = SDL_GetVideoInfo()->vfmt;
+                scr_xrgb = fmt->BitsPerPixel == 32 && fmt->Rmask == 0xFF0000 && fmt->Gmask == 0xFF00 && fmt->Bmask == 0xFF;
+                scr = SDL_SetVideoMode(SCREEN_WIDTH, SCREEN_HEIGHT, scr_xrgb ? 32 : 16, SDL_SWSURFACE);
+                signal(SIGINT, SIG_DFL);
+
+                if(!scr)
+                {
+                    printf("Couldn't open a window (%s), rendering headless.\n", SDL_GetError());
+                    SDL_Quit();
+                }
+            }
+
+            //nglDisplayedFrame can return the pixels of the window only if they're laid out like screen
+            window_has_frame = scr != nullptr && !scr_xrgb && scr->pitch == SCREEN_WIDTH*sizeof(COLOR);
+        #endif
+
+        if(!window_has_frame)
+            frame_copy = new COLOR[SCREEN_WIDTH*SCREEN_HEIGHT]();
+    #endif
+
+    displayed_frame = nullptr;
+
+    #ifdef DIRTY_RECTANGLES
+        nglMarkAllDirty();
+    #endif
+
+    #ifdef OVERDRAW_HEATMAP
+        overdraw_tests = new uint8_t[SCREEN_WIDTH*SCREEN_HEIGHT]();
+        overdraw_writes = new uint8_t[SCREEN_WIDTH*SCREEN_HEIGHT]();
+        heatmap = HEATMAP_OFF;
+        overdraw_stats = OVERDRAW_STATS();
+    #endif
+
+    #ifdef LAZY_CLEAR
+        std::fill(pending_color, pending_color + TILE_ROWS, 0);
+        std::fill(pending_depth, pending_depth + TILE_ROWS, 0);
     #endif
 
     matrix_stack_left = MATRIX_STACK_SIZE;
+
+    #ifdef LIGHTING
+        lighting = false;
+        ambient_light = 0;
+        for(LIGHT &light : lights)
+            light.intensity = 0;
+        normal = VECTOR3(0, 0, -1);
+    #endif
 }
 
+static void stopBufferRotation();
+
 void nglUninit()
 {
-    uninit_fastmath();
+    stopBufferRotation();
+
     delete[] transformation;
+    delete[] reciprocals;
     delete[] z_buffer;
 
     delete[] screen_inverted;
+    uninitDrawArray();
+
+    #ifdef OVERDRAW_HEATMAP
+        delete[] overdraw_tests;
+        delete[] overdraw_writes;
+    #endif
 
     #ifdef _TINSPIRE
         lcd_init(SCR_TYPE_INVALID);
     #else
-        //TODO
+        delete[] frame_copy;
+        frame_copy = nullptr;
+
+        #ifndef HEADLESS
+            if(scr)
+                SDL_Quit();
+
+            scr = nullptr;
+        #endif
     #endif
+
+    displayed_frame = nullptr;
 }
 
-void nglMultMatMat(MATRIX *mat1, MATRIX *mat2)
-{
-    GLFix a00 = P(mat1, 0, 0), a01 = P(mat1, 0, 1), a02 = P(mat1, 0, 2);
-    GLFix a10 = P(mat1, 1, 0), a11 = P(mat1, 1, 1), a12 = P(mat1, 1, 2);
-    GLFix a20 = P(mat1, 2, 0), a21 = P(mat1, 2, 1), a22 = P(mat1, 2, 2);
+#ifdef WIDE_FIXED_POINT
+    static_assert(sizeof(GLFix::wide_type) >= 2 * sizeof(GLFix::type), "Products of GLFix have to fit into the intermediate type");
+
+    // The intermediate values can hold any product, so nothing has to be traded for range
+    typedef GLFix Translation;
+#else
     // Multiplying GLFix with GLFix uses a Fix<16> intermediate value,
     // which limits the result to 16 bits, while Fix * int does not lose
     // width. Allow for greater range by treating this column as integers.
     // This way, glTranslatef(x) + glTranslatef(-x) cancels each other
     // out even for large x.
-    int a03 = P(mat1, 0, 3), a13 = P(mat1, 1, 3), a23 = P(mat1, 2, 3);
+    typedef int Translation;
+#endif
+
+void nglMultMatMat(MATRIX *mat1, const MATRIX *mat2)
+{
+    GLFix a00 = P(mat1, 0, 0), a01 = P(mat1, 0, 1), a02 = P(mat1, 0, 2);
+    GLFix a10 = P(mat1, 1, 0), a11 = P(mat1, 1, 1), a12 = P(mat1, 1, 2);
+    GLFix a20 = P(mat1, 2, 0), a21 = P(mat1, 2, 1), a22 = P(mat1, 2, 2);
+    Translation a03 = P(mat1, 0, 3), a13 = P(mat1, 1, 3), a23 = P(mat1, 2, 3);
 
     GLFix b00 = P(mat2, 0, 0), b01 = P(mat2, 0, 1), b02 = P(mat2, 0, 2);
     GLFix b10 = P(mat2, 1, 0), b11 = P(mat2, 1, 1), b12 = P(mat2, 1, 2);
     GLFix b20 = P(mat2, 2, 0), b21 = P(mat2, 2, 1), b22 = P(mat2, 2, 2);
-    int b03 = P(mat2, 0, 3), b13 = P(mat2, 1, 3), b23 = P(mat2, 2, 3);
+    Translation b03 = P(mat2, 0, 3), b13 = P(mat2, 1, 3), b23 = P(mat2, 2, 3);
 
     P(mat1, 0, 0) = a00*b00 + a01*b10 + a02*b20;
     P(mat1, 0, 1) = a00*b01 + a01*b11 + a02*b21;
@@ -118,6 +343,7 @@ void nglMultMatMat(MATRIX *mat1, MATRIX *mat2)
 void nglMultMatVectRes(const MATRIX *mat1, const VERTEX *vect, VERTEX *res)
 {
     GLFix x = vect->x, y = vect->y, z = vect->z;
+    COUNT_STAT(vertices, 1);
 
     res->x = P(mat1, 0, 0)*x + P(mat1, 0, 1)*y + P(mat1, 0, 2)*z + P(mat1, 0, 3);
     res->y = P(mat1, 1, 0)*x + P(mat1, 1, 1)*y + P(mat1, 1, 2)*z + P(mat1, 1, 3);
@@ -127,37 +353,60 @@ void nglMultMatVectRes(const MATRIX *mat1, const VERTEX *vect, VERTEX *res)
 void nglMultMatVectRes(const MATRIX *mat1, const VECTOR3 *vect, VECTOR3 *res)
 {
     GLFix x = vect->x, y = vect->y, z = vect->z;
+    COUNT_STAT(vertices, 1);
 
     res->x = P(mat1, 0, 0)*x + P(mat1, 0, 1)*y + P(mat1, 0, 2)*z + P(mat1, 0, 3);
     res->y = P(mat1, 1, 0)*x + P(mat1, 1, 1)*y + P(mat1, 1, 2)*z + P(mat1, 1, 3);
     res->z = P(mat1, 2, 0)*x + P(mat1, 2, 1)*y + P(mat1, 2, 2)*z + P(mat1, 2, 3);
 }
 
-void nglPerspective(VERTEX *v)
+//focal length / z, which is at most focal length / CLIP_PLANE.
+//Only the quotient is stored in a PerspectiveFix, the focal length is divided as int64_t.
+#ifdef WIDE_FIXED_POINT
+    typedef Fix<20, GLFix::type, GLFix::wide_type> PerspectiveFix;
+#else
+    typedef Fix<12, int32_t> PerspectiveFix;
+#endif
+#define MAX_FOCAL_LENGTH (8 * SCREEN_WIDTH)
+static_assert((int64_t(MAX_FOCAL_LENGTH) << PerspectiveFix::precision) / CLIP_PLANE <= std::numeric_limits<PerspectiveFix::type>::max(),
+              "focal length / CLIP_PLANE has to fit for focal lengths of up to 8 times the screen width");
+static_assert(CLIP_PLANE >= 2 && (int64_t(MAX_FOCAL_LENGTH) << PerspectiveFix::precision) <= INT64_MAX / ((uint64_t(1) << 32) / CLIP_PLANE + 1),
+              "The product with the largest reciprocal, the one of CLIP_PLANE, has to fit into an int64_t");
+
+//Projects x and y, the perspective divide uses a table lookup instead of a division if possible
+static inline void project(GLFix &x, GLFix &y, const GLFix z)
 {
-#ifdef BETTER_PERSPECTIVE
-    float new_z = v->z;
-    decltype(new_z) new_x = v->x, new_y = v->y;
-    decltype(new_z) div = decltype(new_z)(near_plane)/new_z;
+    const int64_t focal_x = int64_t(projection.focal_x.value) << (PerspectiveFix::precision - GLFix::precision),
+                  focal_y = int64_t(projection.focal_y.value) << (PerspectiveFix::precision - GLFix::precision);
+    PerspectiveFix div_x, div_y;
 
-    new_x *= div;
-    new_y *= div;
+    const int z_int = z.toInteger<int>();
+    if(__builtin_expect(z_int >= 0 && z_int < RECIPROCAL_TABLE_SIZE, 1))
+    {
+        const uint32_t reciprocal = reciprocals[z_int];
+        div_x.value = (focal_x * reciprocal) >> 32;
+        div_y.value = (focal_y * reciprocal) >> 32;
+    }
+    else
+    {
+        div_x.value = focal_x / z_int;
+        div_y.value = focal_y / z_int;
+    }
 
-    v->x = new_x;
-    v->y = new_y;
+#ifdef WIDE_FIXED_POINT
+    //The result has the precision of x, so it can't overflow for vertices near the clip plane
+    x = projection.center_x + x * div_x;
+    y = projection.center_y - y * div_y;
 #else
-    auto div = Fix<12, int32_t>(near_plane)/v->z.toInteger<int>();
-
     //Round to integers, as we don't lose the topmost bits with integer multiplication
-    v->x = div * v->x.toInteger<int>();
-    v->y = div * v->y.toInteger<int>();
+    x = projection.center_x + GLFix(div_x * x.toInteger<int>());
+    y = projection.center_y - GLFix(div_y * y.toInteger<int>());
 #endif
+}
 
-    // (0/0) is in the center of the screen
-    v->x += SCREEN_WIDTH/2;
-    v->y += SCREEN_HEIGHT/2;
-
-    v->y = GLFix(SCREEN_HEIGHT - 1) - v->y;
+void nglPerspective(VERTEX *v)
+{
+    project(v->x, v->y, v->z);
 
     //TODO: Move this somewhere else
     if(!texture)
@@ -188,55 +437,434 @@ void nglPerspective(VERTEX *v)
 
 void nglPerspective(VECTOR3 *v)
 {
-#ifdef BETTER_PERSPECTIVE
-    float new_z = v->z;
-    decltype(new_z) new_x = v->x, new_y = v->y;
-    decltype(new_z) div = decltype(new_z)(near_plane)/new_z;
+    project(v->x, v->y, v->z);
+}
 
-    new_x *= div;
-    new_y *= div;
+void nglSetBuffer(COLOR *screenBuf)
+{
+    #ifdef LAZY_CLEAR
+        if(screen)
+            clearPendingColor();
+    #endif
 
-    v->x = new_x;
-    v->y = new_y;
-#else
-    auto div = Fix<12, int32_t>(near_plane)/v->z.toInteger<int>();
+    stopBufferRotation();
+    screen = screenBuf;
 
-    //Round to integers, as we don't lose the topmost bits with integer multiplication
-    v->x = div * v->x.toInteger<int>();
-    v->y = div * v->y.toInteger<int>();
+    #ifdef DIRTY_RECTANGLES
+        nglMarkAllDirty();
+    #endif
+}
+
+static const DIRTY_LIST full_screen = {true, 1, {{0, 0, SCREEN_WIDTH, SCREEN_HEIGHT}}};
+
+#ifdef DIRTY_RECTANGLES
+//Adds the rectangle to the list, merging it with others if they overlap or the list is full
+static void addDirtyRect(DIRTY_LIST &list, DIRTY_RECT r)
+{
+    if(list.all)
+        return;
+
+    if(r.x1 < 0) r.x1 = 0;
+    if(r.y1 < 0) r.y1 = 0;
+    if(r.x2 > SCREEN_WIDTH) r.x2 = SCREEN_WIDTH;
+    if(r.y2 > SCREEN_HEIGHT) r.y2 = SCREEN_HEIGHT;
+    if(r.x1 >= r.x2 || r.y1 >= r.y2)
+        return;
+
+    //Merge with the rectangle which grows the least, unless there's space left and none overlaps
+    unsigned int best = 0;
+    int best_growth = INT32_MAX;
+    for(unsigned int i = 0; i < list.count; ++i)
+    {
+        const DIRTY_RECT &o = list.rects[i];
+        const DIRTY_RECT u = {std::min(o.x1, r.x1), std::min(o.y1, r.y1), std::max(o.x2, r.x2), std::max(o.y2, r.y2)};
+        const bool overlaps = r.x1 <= o.x2 && o.x1 <= r.x2 && r.y1 <= o.y2 && o.y1 <= r.y2;
+        const int growth = overlaps ? -1 : (u.x2 - u.x1) * (u.y2 - u.y1) - (o.x2 - o.x1) * (o.y2 - o.y1);
+        if(growth < best_growth)
+        {
+            best = i;
+            best_growth = growth;
+        }
+    }
+
+    if(best_growth >= 0 && list.count < DIRTY_LIST_SIZE)
+    {
+        list.rects[list.count++] = r;
+        return;
+    }
+
+    DIRTY_RECT &o = list.rects[best];
+    o = {std::min(o.x1, r.x1), std::min(o.y1, r.y1), std::max(o.x2, r.x2), std::max(o.y2, r.y2)};
+    if(o.x1 == 0 && o.y1 == 0 && o.x2 == SCREEN_WIDTH && o.y2 == SCREEN_HEIGHT)
+        list = full_screen;
+}
 #endif
 
-    // (0/0) is in the center of the screen
-    v->x += SCREEN_WIDTH/2;
-    v->y += SCREEN_HEIGHT/2;
+void nglMarkDirty(const COLOR *buffer, const int x, const int y, const int w, const int h)
+{
+    #ifdef DIRTY_RECTANGLES
+        if(buffer == screen)
+            addDirtyRect(dirty_current, {x, y, x + w, y + h});
+    #elif defined(LAZY_CLEAR)
+        if(buffer == screen && w > 0)
+            for(int line = std::max(y, 0) & ~(TILE_SIZE - 1); line < y + h && line < SCREEN_HEIGHT; line += TILE_SIZE)
+                clearTilesOfSpan(line, x, x + w - 1);
+    #else
+        (void) buffer; (void) x; (void) y; (void) w; (void) h;
+    #endif
+}
 
-    v->y = GLFix(SCREEN_HEIGHT - 1) - v->y;
+void nglMarkAllDirty()
+{
+    #ifdef DIRTY_RECTANGLES
+        dirty_current = full_screen;
+    #endif
 }
 
-void nglSetBuffer(COLOR *screenBuf)
+#if defined(RENDER_STATS) || defined(OVERDRAW_HEATMAP)
+void nglCountWritten(const COLOR *buffer, const COLOR *first, const unsigned int count)
 {
-    screen = screenBuf;
+    if(buffer != screen)
+        return;
+
+    COUNT_STAT(pixels_written, count);
+    #ifdef OVERDRAW_HEATMAP
+        //Not depth tested, so they only count as writes
+        for(unsigned int i = 0; i < count; ++i)
+            countOverdraw(overdraw_writes, first - buffer + i);
+    #else
+        (void) first;
+    #endif
 }
+#endif
 
-void nglDisplay()
+//Shows the dirty parts of frame on the display, the window and/or in frame_copy
+static void present(const COLOR *frame, const DIRTY_LIST &dirty)
 {
+    if(dirty.count == 0)
+        return;
+
+    TRACE_SCOPE("present");
+
     #ifdef _TINSPIRE
         if(is_monochrome)
         {
-            //Flip everything, as 0xFFFF is white on CX, but black on classic
-            COLOR *ptr = screen + SCREEN_HEIGHT*SCREEN_WIDTH, *ptr_inv = screen_inverted + SCREEN_HEIGHT*SCREEN_WIDTH;
-            while(--ptr >= screen)
-                *--ptr_inv = ~*ptr;
+            //Flip everything, as 0xFFFF is white on CX, but black on classic.
+            //screen_inverted keeps the last frame, so only the dirty parts have to be redone.
+            for(unsigned int i = 0; i < dirty.count; ++i)
+            {
+                const DIRTY_RECT &r = dirty.rects[i];
+                for(int y = r.y1; y < r.y2; ++y)
+                    invertRGB565(frame + r.x1 + y*SCREEN_WIDTH, screen_inverted + r.x1 + y*SCREEN_WIDTH, r.x2 - r.x1);
+            }
 
             lcd_blit(screen_inverted, SCR_320x240_16);
         }
         else
-            lcd_blit(screen, SCR_320x240_565);
+            lcd_blit(const_cast<COLOR*>(frame), SCR_320x240_565);
+
+        displayed_frame = frame;
+    #else
+        if(frame_copy)
+        {
+            for(unsigned int i = 0; i < dirty.count; ++i)
+            {
+                const DIRTY_RECT &r = dirty.rects[i];
+                for(int y = r.y1; y < r.y2; ++y)
+                    std::copy(frame + r.x1 + y*SCREEN_WIDTH, frame + r.x2 + y*SCREEN_WIDTH, frame_copy + r.x1 + y*SCREEN_WIDTH);
+            }
+
+            displayed_frame = frame_copy;
+        }
+
+        #ifndef HEADLESS
+            if(!scr)
+                return;
+
+            SDL_LockSurface(scr);
+
+            uint8_t *pixels = reinterpret_cast<uint8_t*>(scr->pixels);
+            for(unsigned int i = 0; i < dirty.count; ++i)
+            {
+                const DIRTY_RECT &r = dirty.rects[i];
+                for(int y = r.y1; y < r.y2; ++y)
+                {
+                    const COLOR *line = frame + y*SCREEN_WIDTH;
+                    if(scr_xrgb)
+                        convertRGB565ToXRGB8888(line + r.x1, reinterpret_cast<uint32_t*>(pixels + y*scr->pitch) + r.x1, r.x2 - r.x1);
+                    else
+                        std::copy(line + r.x1, line + r.x2, reinterpret_cast<COLOR*>(pixels + y*scr->pitch) + r.x1);
+                }
+            }
+
+            if(!frame_copy)
+                displayed_frame = reinterpret_cast<COLOR*>(pixels);
+
+            SDL_UnlockSurface(scr);
+
+            SDL_Rect rects[DIRTY_LIST_SIZE];
+            for(unsigned int i = 0; i < dirty.count; ++i)
+            {
+                const DIRTY_RECT &r = dirty.rects[i];
+                rects[i].x = r.x1;
+                rects[i].y = r.y1;
+                rects[i].w = r.x2 - r.x1;
+                rects[i].h = r.y2 - r.y1;
+            }
+
+            SDL_UpdateRects(scr, dirty.count, rects);
+        #endif
+    #endif
+}
+
+#ifndef _TINSPIRE
+static void presentThread()
+{
+    std::unique_lock<std::mutex> lock(present_mutex);
+    for(;;)
+    {
+        present_condition.wait(lock, []{ return present_stop || !present_queue.empty(); });
+        //Show everything queued before stopping
+        if(present_queue.empty())
+            return;
+
+        presenting = present_queue.front();
+        present_queue.pop_front();
+
+        lock.unlock();
+        //The other buffers have older contents, so the dirty rectangles don't apply
+        present(presenting, full_screen);
+        lock.lock();
+
+        presenting = nullptr;
+        present_condition.notify_all();
+    }
+}
+#endif
+
+//Waits until the present thread is done with buffer, or with all buffers if it's nullptr
+static void waitForPresent(const COLOR *buffer)
+{
+    #ifndef _TINSPIRE
+        std::unique_lock<std::mutex> lock(present_mutex);
+        present_condition.wait(lock, [buffer]{
+            if(!buffer)
+                return !presenting && present_queue.empty();
+
+            return presenting != buffer && std::find(present_queue.begin(), present_queue.end(), buffer) == present_queue.end();
+        });
     #else
-        SDL_LockSurface(scr);
-        std::copy(screen, screen + SCREEN_HEIGHT*SCREEN_WIDTH, reinterpret_cast<COLOR*>(scr->pixels));
-        SDL_UnlockSurface(scr);
-        SDL_UpdateRect(scr, 0, 0, 0, 0);
+        (void) buffer;
+    #endif
+}
+
+static void stopBufferRotation()
+{
+    if(rotation_count == 0)
+        return;
+
+    #ifndef _TINSPIRE
+        {
+            std::lock_guard<std::mutex> lock(present_mutex);
+            present_stop = true;
+        }
+
+        present_condition.notify_all();
+        present_thread.join();
+        present_stop = false;
+    #endif
+
+    for(unsigned int i = 0; i < rotation_count; ++i)
+    {
+        //On the calculator, the last frame is still in there
+        if(displayed_frame == rotation_buffers[i])
+            displayed_frame = nullptr;
+
+        delete[] rotation_buffers[i];
+        rotation_buffers[i] = nullptr;
+    }
+
+    screen = nullptr;
+    rotation_count = 0;
+}
+
+COLOR *nglSetBufferRotation(const unsigned int count)
+{
+    #ifdef LAZY_CLEAR
+        if(screen)
+            clearPendingColor();
+    #endif
+
+    stopBufferRotation();
+
+    if(count < 2 || count > MAX_BUFFER_ROTATION)
+    {
+        if(count != 0)
+            printf("Error: Buffer rotation needs 2 to %d buffers!\n", MAX_BUFFER_ROTATION);
+
+        return nullptr;
+    }
+
+    for(unsigned int i = 0; i < count; ++i)
+        rotation_buffers[i] = new COLOR[SCREEN_WIDTH*SCREEN_HEIGHT]();
+
+    rotation_count = count;
+    rotation_index = 0;
+    screen = rotation_buffers[0];
+
+    #ifdef DIRTY_RECTANGLES
+        nglMarkAllDirty();
+    #endif
+
+    #ifndef _TINSPIRE
+        present_thread = std::thread(presentThread);
+    #endif
+
+    return screen;
+}
+
+COLOR *nglGetBuffer()
+{
+    return screen;
+}
+
+const COLOR *nglDisplayedFrame()
+{
+    waitForPresent(nullptr);
+    return displayed_frame;
+}
+
+#ifdef RENDER_STATS
+    const FRAME_STATS &nglGetStats()
+    {
+        return last_frame_stats;
+    }
+#endif
+
+#ifdef OVERDRAW_HEATMAP
+    void nglSetHeatmap(const NGL_HEATMAP mode)
+    {
+        heatmap = mode;
+    }
+
+    const OVERDRAW_STATS &nglGetOverdrawStats()
+    {
+        return overdraw_stats;
+    }
+
+    static void countsOfFrame(const uint8_t *counters, unsigned int &min, unsigned int &max, GLFix &avg)
+    {
+        min = UINT8_MAX;
+        max = 0;
+        uint64_t total = 0;
+        for(unsigned int i = 0; i < SCREEN_WIDTH*SCREEN_HEIGHT; ++i)
+        {
+            min = std::min(min, unsigned(counters[i]));
+            max = std::max(max, unsigned(counters[i]));
+            total += counters[i];
+        }
+
+        avg.value = (total << 8) / (SCREEN_WIDTH*SCREEN_HEIGHT);
+    }
+
+    //Collects the stats of the frame, replaces it with the heatmap if enabled and starts counting again
+    static void finishOverdraw()
+    {
+        countsOfFrame(overdraw_tests, overdraw_stats.min_tests, overdraw_stats.max_tests, overdraw_stats.avg_tests);
+        countsOfFrame(overdraw_writes, overdraw_stats.min_writes, overdraw_stats.max_writes, overdraw_stats.avg_writes);
+
+        if(heatmap != HEATMAP_OFF)
+        {
+            static const COLOR palette[] = {0x0000, 0x001F, 0x07FF, 0x07E0, 0xFFE0, 0xFC00, 0xF800, 0xFFFF};
+            const unsigned int palette_size = sizeof(palette) / sizeof(*palette);
+
+            const uint8_t *counters = heatmap == HEATMAP_DEPTH_TESTS ? overdraw_tests : overdraw_writes;
+            for(unsigned int i = 0; i < SCREEN_WIDTH*SCREEN_HEIGHT; ++i)
+                screen[i] = palette[std::min(unsigned(counters[i]), palette_size - 1)];
+
+            #ifdef DIRTY_RECTANGLES
+                nglMarkAllDirty();
+            #endif
+        }
+
+        std::fill(overdraw_tests, overdraw_tests + SCREEN_WIDTH*SCREEN_HEIGHT, 0);
+        std::fill(overdraw_writes, overdraw_writes + SCREEN_WIDTH*SCREEN_HEIGHT, 0);
+    }
+#endif
+
+bool nglIsHeadless()
+{
+    #ifdef _TINSPIRE
+        return false;
+    #else
+        #ifdef HEADLESS
+            return true;
+        #else
+            return scr == nullptr;
+        #endif
+    #endif
+}
+
+void nglDisplay()
+{
+    TRACE_SCOPE("nglDisplay");
+
+    #ifdef LAZY_CLEAR
+        clearPendingColor();
+    #endif
+
+    #ifdef OVERDRAW_HEATMAP
+        finishOverdraw();
+    #endif
+
+    if(display_hook)
+        display_hook(screen);
+
+    if(rotation_count == 0)
+    {
+        #ifdef DIRTY_RECTANGLES
+            //What was drawn in the previous frame got cleared, so it changed as well
+            DIRTY_LIST dirty = dirty_current;
+            for(unsigned int i = 0; i < dirty_previous.count; ++i)
+                addDirtyRect(dirty, dirty_previous.rects[i]);
+
+            present(screen, dirty_previous.all ? full_screen : dirty);
+            dirty_previous = dirty_current;
+            dirty_current = DIRTY_LIST();
+        #else
+            present(screen, full_screen);
+        #endif
+    }
+    else
+    {
+        #ifndef _TINSPIRE
+            {
+                std::lock_guard<std::mutex> lock(present_mutex);
+                present_queue.push_back(screen);
+            }
+
+            present_condition.notify_all();
+        #else
+            //No threads, so the rotation doesn't gain anything here
+            present(screen, full_screen);
+        #endif
+
+        rotation_index = (rotation_index + 1) % rotation_count;
+        screen = rotation_buffers[rotation_index];
+        waitForPresent(screen);
+
+        #ifdef DIRTY_RECTANGLES
+            nglMarkAllDirty();
+        #endif
+    }
+
+    #ifdef RENDER_STATS
+        last_frame_stats = frame_stats;
+        frame_stats = FRAME_STATS();
+    #endif
+
+    #ifdef FRAME_TIMING
+        frameTimingDisplay();
     #endif
 
     #ifdef FPS_COUNTER
@@ -255,11 +883,17 @@ void nglDisplay()
     #endif
 }
 
+void nglSetDisplayHook(NGLDISPLAYHOOK hook)
+{
+    display_hook = hook;
+}
+
 void nglRotateX(const GLFix a)
 {
     MATRIX rot;
 
-    const GLFix sina = fast_sin(a), cosa = fast_cos(a);
+    FFix sina, cosa;
+    fast_sincos(a, sina, cosa);
 
     M(rot, 0, 0) = 1;
     M(rot, 1, 1) = cosa;
@@ -274,7 +908,8 @@ void nglRotateY(const GLFix a)
 {
     MATRIX rot;
 
-    const GLFix sina = fast_sin(a), cosa = fast_cos(a);
+    FFix sina, cosa;
+    fast_sincos(a, sina, cosa);
 
     M(rot, 0, 0) = cosa;
     M(rot, 0, 2) = sina;
@@ -289,7 +924,8 @@ void nglRotateZ(const GLFix a)
 {
     MATRIX rot;
 
-    const GLFix sina = fast_sin(a), cosa = fast_cos(a);
+    FFix sina, cosa;
+    fast_sincos(a, sina, cosa);
 
     M(rot, 0, 0) = cosa;
     M(rot, 0, 1) = -sina;
@@ -307,9 +943,17 @@ inline void pixel(const int x, const int y, const GLFix z, const COLOR c)
 
     const int pitch = x + y*SCREEN_WIDTH;
 
+    #ifdef LAZY_CLEAR
+        clearTilesOfSpan(y, x, x);
+    #endif
+
+    COUNT_STAT(pixels_tested, 1);
+    COUNT_OVERDRAW(overdraw_tests, pitch);
     if(z <= GLFix(CLIP_PLANE) || GLFix(z_buffer[pitch]) <= z)
         return;
 
+    COUNT_STAT(pixels_written, 1);
+    COUNT_OVERDRAW(overdraw_writes, pitch);
     z_buffer[pitch] = z;
 
     screen[pitch] = c;
@@ -343,6 +987,11 @@ GLFix nglZBufferAt(const unsigned int x, const unsigned int y)
     if(x >= SCREEN_WIDTH || y >= SCREEN_HEIGHT)
         return 0;
 
+    #ifdef LAZY_CLEAR
+        if(pending_depth[y >> TILE_SHIFT] & (1u << (x >> TILE_SHIFT)))
+            return UINT16_MAX;
+    #endif
+
     return z_buffer[x + y * SCREEN_WIDTH];
 }
 
@@ -355,6 +1004,11 @@ void nglDrawLine3D(const VERTEX *v1, const VERTEX *v2)
     nglPerspective(&v1_p);
     nglPerspective(&v2_p);
 
+    #ifdef DIRTY_RECTANGLES
+        addDirtyRect(dirty_current, {std::min(v1_p.x, v2_p.x).floor(), std::min(v1_p.y, v2_p.y).floor(),
+                                     std::max(v1_p.x, v2_p.x).floor() + 2, std::max(v1_p.y, v2_p.y).floor() + 2});
+    #endif
+
     const GLFix diff_x = v2_p.x - v1_p.x;
     const GLFix dy = (v2_p.y - v1_p.y) / diff_x;
 
@@ -406,8 +1060,46 @@ void nglDrawLine3D(const VERTEX *v1, const VERTEX *v2)
     }
 }
 
+#if defined(TEXTURE_SUPPORT) && defined(LIGHTING)
+    //A texel c gets drawn as ((c >> shift) & mask) - ((c >> 2) & mask_sub), depending on the shade level
+    struct TEXTURE_SHADE
+    {
+        unsigned int shift;
+        COLOR mask, mask_sub;
+    };
+
+    static const TEXTURE_SHADE texture_shades[TEXTURE_SHADE_MASK + 1] = {
+        {0, 0xFFFF, 0x0000}, //100%
+        {0, 0xFFFF, 0x39E7}, //75%
+        {1, 0x7BEF, 0x0000}, //50%
+        {2, 0x39E7, 0x0000}, //25%
+    };
+#endif
+
+#ifdef TEXTURE_SUPPORT
+    static inline COLOR texelIndexed4(const TEXTURE &tex, const unsigned int stride, const int u, const int v)
+    {
+        const uint8_t indices = tex.indices[(u >> 1) + v * stride];
+        return tex.palette[(u & 1) ? (indices & 0xF) : (indices >> 4)];
+    }
+#endif
+
 //I hate code duplication more than macros and includes
 #ifdef TEXTURE_SUPPORT
+    //Paletted textures, opaque and transparent
+    #define TEXEL_INDEXED 8
+    #include "triangle.inc.h"
+    #define TRANSPARENCY
+    #include "triangle.inc.h"
+    #undef TRANSPARENCY
+    #undef TEXEL_INDEXED
+    #define TEXEL_INDEXED 4
+    #include "triangle.inc.h"
+    #define TRANSPARENCY
+    #include "triangle.inc.h"
+    #undef TRANSPARENCY
+    #undef TEXEL_INDEXED
+
     #define TRANSPARENCY
     #include "triangle.inc.h"
     #undef TRANSPARENCY
@@ -483,6 +1175,7 @@ void nglDrawTriangleXRightZClipped(const VERTEX *low, const VERTEX *middle, cons
     case 1:
         interpolateVertexXLeft(invisible[0], visible[0], &v1);
         interpolateVertexXLeft(invisible[0], visible[1], &v2);
+        COUNT_STAT(split, 1);
         nglDrawTriangleXZClipped(visible[0], visible[1], &v1);
         nglDrawTriangleXZClipped(visible[1], &v1, &v2);
         break;
@@ -522,12 +1215,22 @@ static void interpolateVertexXRight(const VERTEX *from, const VERTEX *to, VERTEX
 //Right X clipping
 void nglDrawTriangleZClipped(const VERTEX *low, const VERTEX *middle, const VERTEX *high)
 {
+    TRACE_SCOPE("nglDrawTriangleZClipped");
+
     //If not on screen, skip
     if((low->x < GLFix(0) && middle->x < GLFix(0) && high->x < GLFix(0))
        || (low->x >= GLFix(SCREEN_WIDTH) && middle->x >= GLFix(SCREEN_WIDTH) && high->x >= GLFix(SCREEN_WIDTH))
        || (low->y < GLFix(0) && middle->y < GLFix(0) && high->y < GLFix(0))
        || (low->y >= GLFix(SCREEN_HEIGHT) && middle->y >= GLFix(SCREEN_HEIGHT) && high->y >= GLFix(SCREEN_HEIGHT)))
+    {
+        COUNT_STAT(culled_frustum, 1);
         return;
+    }
+
+    #ifdef DIRTY_RECTANGLES
+        addDirtyRect(dirty_current, {std::min({low->x, middle->x, high->x}).floor(), std::min({low->y, middle->y, high->y}).floor(),
+                                     std::max({low->x, middle->x, high->x}).floor() + 2, std::max({low->y, middle->y, high->y}).floor() + 2});
+    #endif
 
     const VERTEX* invisible[3];
     const VERTEX* visible[3];
@@ -563,6 +1266,7 @@ void nglDrawTriangleZClipped(const VERTEX *low, const VERTEX *middle, const VERT
     case 1:
         interpolateVertexXRight(invisible[0], visible[0], &v1);
         interpolateVertexXRight(invisible[0], visible[1], &v2);
+        COUNT_STAT(split, 1);
         nglDrawTriangleXRightZClipped(visible[0], visible[1], &v1);
         nglDrawTriangleXRightZClipped(visible[1], &v1, &v2);
         break;
@@ -618,9 +1322,15 @@ bool nglIsBackface(const VECTOR3 *v1, const VECTOR3 *v2, const VECTOR3 *v3)
 
 bool nglDrawTriangle(const VERTEX *low, const VERTEX *middle, const VERTEX *high, bool backface_culling)
 {
+    TRACE_SCOPE("nglDrawTriangle");
+    COUNT_STAT(triangles, 1);
+
 #ifndef Z_CLIPPING
     if(low->z < GLFix(CLIP_PLANE) || middle->z < GLFix(CLIP_PLANE) || high->z < GLFix(CLIP_PLANE))
+    {
+        COUNT_STAT(culled_near, 1);
         return true;
+    }
 
     VERTEX low_p = *low, middle_p = *middle, high_p = *high;
 
@@ -629,14 +1339,20 @@ bool nglDrawTriangle(const VERTEX *low, const VERTEX *middle, const VERTEX *high
     nglPerspective(&high_p);
 
     if(backface_culling && nglIsBackface(&low_p, &middle_p, &high_p))
+    {
+        COUNT_STAT(culled_backface, 1);
         return false;
+    }
 
     nglDrawTriangleZClipped(&low_p, &middle_p, &high_p);
 
     return true;
 #else
     if(low->z < GLFix(CLIP_PLANE) && middle->z < GLFix(CLIP_PLANE) && high->z < GLFix(CLIP_PLANE))
+    {
+        COUNT_STAT(culled_near, 1);
         return true;
+    }
 
     VERTEX invisible[3];
     VERTEX visible[3];
@@ -674,7 +1390,10 @@ bool nglDrawTriangle(const VERTEX *low, const VERTEX *middle, const VERTEX *high
         nglPerspective(&v2);
 
         if(backface_culling && nglIsBackface(&visible[0], &v1, &v2))
+        {
+            COUNT_STAT(culled_backface, 1);
             return false;
+        }
 
         nglDrawTriangleZClipped(&visible[0], &v1, &v2);
         return true;
@@ -688,9 +1407,13 @@ bool nglDrawTriangle(const VERTEX *low, const VERTEX *middle, const VERTEX *high
         nglPerspective(&v1);
 
         if(backface_culling && nglIsBackface(&visible[0], &visible[1], &v1))
+        {
+            COUNT_STAT(culled_backface, 1);
             return false;
+        }
 
         nglPerspective(&v2);
+        COUNT_STAT(split, 1);
         nglDrawTriangleZClipped(&visible[0], &visible[1], &v1);
         nglDrawTriangleZClipped(&visible[1], &v1, &v2);
         return true;
@@ -701,7 +1424,10 @@ bool nglDrawTriangle(const VERTEX *low, const VERTEX *middle, const VERTEX *high
         nglPerspective(&visible[2]);
 
         if(backface_culling && nglIsBackface(&visible[0], &visible[1], &visible[2]))
+        {
+            COUNT_STAT(culled_backface, 1);
             return false;
+        }
 
         nglDrawTriangleZClipped(&visible[0], &visible[1], &visible[2]);
         return true;
@@ -730,6 +1456,8 @@ void nglAddVertex(const VERTEX &vertex)
 
 void nglAddVertex(const VERTEX* vertex)
 {
+    TRACE_SCOPE("nglAddVertex");
+
     VERTEX *current_vertex = &vertices[vertices_count];
 
     current_vertex->c = vertex->c;
@@ -740,6 +1468,11 @@ void nglAddVertex(const VERTEX* vertex)
 
     nglMultMatVectRes(transformation, vertex, current_vertex);
 
+    #ifdef LIGHTING
+        if(lighting)
+            current_vertex->c = nglLightColor(vertex->c, nglLightIntensity(transformation, &normal));
+    #endif
+
     ++vertices_count;
 
     switch(draw_mode)
@@ -815,20 +1548,64 @@ const TEXTURE *nglGetTexture()
 
 void glBindTexture(const TEXTURE *tex)
 {
+    if(tex && bind_texture_hook)
+        bind_texture_hook(tex);
+
     texture = tex;
 
     if(tex && tex->has_transparency && tex->transparent_color != 0)
         printf("Bound texture doesn't have black as transparent color!\n");
+
+    if(tex && (tex->format == TEXTURE_RGB565 ? !tex->bitmap : (!tex->indices || !tex->palette)))
+    {
+        printf("Bound texture doesn't have any data!\n");
+        texture = nullptr;
+    }
+}
+
+void nglSetBindTextureHook(NGLBINDTEXTUREHOOK hook)
+{
+    bind_texture_hook = hook;
 }
 
 void nglSetNearPlane(const GLFix new_near_plane)
 {
-    near_plane = new_near_plane;
+    projection.focal_x = projection.focal_y = new_near_plane;
+    // (0/0) is in the center of the screen
+    projection.center_x = SCREEN_WIDTH/2;
+    projection.center_y = SCREEN_HEIGHT - 1 - SCREEN_HEIGHT/2;
 }
 
 GLFix nglGetNearPlane()
 {
-    return near_plane;
+    return projection.focal_y;
+}
+
+const PROJECTION *nglGetProjection()
+{
+    return &projection;
+}
+
+void glFrustum(const GLFix left, const GLFix right, const GLFix bottom, const GLFix top, const GLFix near)
+{
+    //Only called once in a while, so use floats for range
+    const float width = float(right) - float(left), height = float(top) - float(bottom);
+    if(width == 0.0f || height == 0.0f)
+    {
+        printf("Error: Invalid frustum!\n");
+        return;
+    }
+
+    projection.focal_x = float(near) * SCREEN_WIDTH / width;
+    projection.focal_y = float(near) * SCREEN_HEIGHT / height;
+    projection.center_x = (SCREEN_WIDTH/2) - (SCREEN_WIDTH/2) * (float(right) + float(left)) / width;
+    projection.center_y = (SCREEN_HEIGHT - 1 - SCREEN_HEIGHT/2) + (SCREEN_HEIGHT/2) * (float(top) + float(bottom)) / height;
+}
+
+void gluPerspective(const GLFix fovy, const GLFix aspect)
+{
+    const float top = tanf(float(fovy) * 3.14159265f / 360.0f), right = top * float(aspect);
+    glFrustum(-right, right, -top, top, 1);
 }
 
 void glColor3f(const GLFix r, const GLFix g, const GLFix b)
@@ -856,6 +1633,52 @@ void glBegin(GLDrawMode mode)
 
 void glClear(const int buffers)
 {
+    #ifdef LAZY_CLEAR
+        //Only mark the tiles, they get cleared when drawn into or by nglDisplay
+        constexpr uint32_t all_tiles = TILE_COLUMNS == 32 ? UINT32_MAX : (1u << TILE_COLUMNS) - 1;
+        if(buffers & GL_COLOR_BUFFER_BIT)
+        {
+            pending_clear_color = color;
+            std::fill(pending_color, pending_color + TILE_ROWS, all_tiles);
+        }
+
+        if(buffers & GL_DEPTH_BUFFER_BIT)
+            std::fill(pending_depth, pending_depth + TILE_ROWS, all_tiles);
+
+        return;
+    #endif
+
+    #ifdef DIRTY_RECTANGLES
+        //Everything else still has the clear color and depth
+        if((buffers & GL_COLOR_BUFFER_BIT) && color != clear_color)
+        {
+            clear_color = color;
+            nglMarkAllDirty();
+        }
+
+        DIRTY_LIST dirty = dirty_current;
+        for(unsigned int i = 0; i < dirty_previous.count; ++i)
+            addDirtyRect(dirty, dirty_previous.rects[i]);
+
+        if(!dirty.all && !dirty_previous.all)
+        {
+            for(unsigned int i = 0; i < dirty.count; ++i)
+            {
+                const DIRTY_RECT &r = dirty.rects[i];
+                for(int y = r.y1; y < r.y2; ++y)
+                {
+                    if(buffers & GL_COLOR_BUFFER_BIT)
+                        std::fill(screen + r.x1 + y*SCREEN_WIDTH, screen + r.x2 + y*SCREEN_WIDTH, color);
+
+                    if(buffers & GL_DEPTH_BUFFER_BIT)
+                        std::fill(z_buffer + r.x1 + y*SCREEN_WIDTH, z_buffer + r.x2 + y*SCREEN_WIDTH, UINT16_MAX);
+                }
+            }
+
+            return;
+        }
+    #endif
+
     if(buffers & GL_COLOR_BUFFER_BIT)
         std::fill(screen, screen + SCREEN_WIDTH*SCREEN_HEIGHT, color);
 
@@ -916,3 +1739,101 @@ void glPushMatrix()
     ++transformation;
     *transformation = *(transformation - 1);
 }
+
+#ifdef LIGHTING
+void nglSetLighting(const bool enabled)
+{
+    lighting = enabled;
+}
+
+bool nglGetLighting()
+{
+    return lighting;
+}
+
+void nglSetAmbientLight(const GLFix intensity)
+{
+    ambient_light = intensity;
+}
+
+void nglSetLight(const unsigned int index, const VECTOR3 &direction, const GLFix intensity)
+{
+    if(index >= MAX_LIGHTS)
+    {
+        printf("Error: Light %u doesn't exist!\n", index);
+        return;
+    }
+
+    LIGHT &light = lights[index];
+    light.intensity = intensity;
+
+    //Only the rotation applies to directions
+    const GLFix x = direction.x, y = direction.y, z = direction.z;
+    const float dx = P(transformation, 0, 0)*x + P(transformation, 0, 1)*y + P(transformation, 0, 2)*z;
+    const float dy = P(transformation, 1, 0)*x + P(transformation, 1, 1)*y + P(transformation, 1, 2)*z;
+    const float dz = P(transformation, 2, 0)*x + P(transformation, 2, 1)*y + P(transformation, 2, 2)*z;
+
+    //Not called often, so floats are fine here
+    const float length = sqrtf(dx*dx + dy*dy + dz*dz);
+    if(length == 0.0f)
+    {
+        light.intensity = 0;
+        return;
+    }
+
+    light.direction = VECTOR3(dx / length, dy / length, dz / length);
+}
+
+void glNormal3f(const GLFix x, const GLFix y, const GLFix z)
+{
+    normal = VECTOR3(x, y, z);
+}
+
+GLFix nglLightIntensity(const MATRIX *mat, const VECTOR3 *normal)
+{
+    const GLFix x = normal->x, y = normal->y, z = normal->z;
+    const GLFix nx = P(mat, 0, 0)*x + P(mat, 0, 1)*y + P(mat, 0, 2)*z;
+    const GLFix ny = P(mat, 1, 0)*x + P(mat, 1, 1)*y + P(mat, 1, 2)*z;
+    const GLFix nz = P(mat, 2, 0)*x + P(mat, 2, 1)*y + P(mat, 2, 2)*z;
+
+    GLFix intensity = ambient_light;
+    for(const LIGHT &light : lights)
+    {
+        if(light.intensity == GLFix(0))
+            continue;
+
+        const GLFix dot = nx*light.direction.x + ny*light.direction.y + nz*light.direction.z;
+        if(dot > GLFix(0))
+            intensity += dot * light.intensity;
+    }
+
+    return std::min(intensity, GLFix(1));
+}
+
+COLOR nglLightColor(const COLOR c, const GLFix intensity)
+{
+    #ifdef TEXTURE_SUPPORT
+        if(texture)
+        {
+            //Texels can't be multiplied cheaply, so pick one of the fixed shade levels
+            unsigned int shade;
+            if(intensity >= GLFix(0.875f))
+                shade = 0;
+            else if(intensity >= GLFix(0.625f))
+                shade = 1;
+            else if(intensity >= GLFix(0.375f))
+                shade = 2;
+            else
+                shade = 3;
+
+            return (c & ~TEXTURE_SHADE_MASK) | shade;
+        }
+    #endif
+
+    //Spread the components out to have space for the multiplication: 00000gggggg00000rrrrr000000bbbbb
+    const unsigned int alpha = std::max(intensity.value, 0) >> (GLFix::precision - 5);
+    uint32_t spread = (c | (c << 16)) & 0x07E0F81F;
+    spread = ((spread * alpha) >> 5) & 0x07E0F81F;
+    return spread | (spread >> 16);
+}
+#endif
@@ -16,9 +16,18 @@
 #define SCREEN_WIDTH 320
 #define SCREEN_HEIGHT 240
 
+//Used to be implemented with floats, WIDE_FIXED_POINT is more precise and faster
+#ifdef BETTER_PERSPECTIVE
+    #define WIDE_FIXED_POINT
+#endif
+
 //GLFix is an integral part of all calculations.
 //Changing resolution and width may be an improvement or even break everything.
-typedef Fix<8, int32_t> GLFix;
+#ifdef WIDE_FIXED_POINT
+    typedef Fix<8, int32_t, int64_t> GLFix;
+#else
+    typedef Fix<8, int32_t> GLFix;
+#endif
 
 /* Column vectors and matrices:
  * [ [0][0] [0][1] [0][2] [0][3] ]   [x]
@@ -26,14 +35,17 @@ typedef Fix<8, int32_t> GLFix;
  * [ [2][0] [2][1] [2][2] [2][3] ]   [z]
  * [   0      0      0      1    ]   [1] (implicit)
  *
- * The 4th row (translation) is treated with integer precision only
- * for greater range during matrix multiplication.
+ * Without WIDE_FIXED_POINT, the 4th row (translation) is treated with
+ * integer precision only for greater range during matrix multiplication.
  */
 
 /* If TEXTURE_SUPPORT is enabled and a VERTEX has this as color, black pixels of the texture won't be drawn */
 #define TEXTURE_TRANSPARENT 0xF000
 /* Disables backface culling for this face */
 #define TEXTURE_DRAW_BACKFACE 0x0F00
+/* With LIGHTING, these bits of a textured VERTEX's color select the shade level, 0 is the brightest.
+ * They are overwritten by the lighting stage and ignored while lighting is disabled. */
+#define TEXTURE_SHADE_MASK 0x0003
 
 typedef uint16_t COLOR;
 
@@ -61,11 +73,24 @@ struct VERTEX
     COLOR c;
 };
 
+enum TEXTURE_FORMAT : uint8_t
+{
+    TEXTURE_RGB565 = 0,
+    TEXTURE_INDEXED8,
+    TEXTURE_INDEXED4
+};
+
 struct TEXTURE
 {
     uint16_t width; uint16_t height;
     bool has_transparency; COLOR transparent_color;
     COLOR *bitmap;
+    //Paletted textures use indices into palette instead of bitmap.
+    //INDEXED4 rows are padded to whole bytes, the left pixel is in the high nibble.
+    //Palette entries equal to transparent_color are transparent.
+    TEXTURE_FORMAT format;
+    uint8_t *indices;
+    COLOR *palette;
 };
 
 class MATRIX {
@@ -85,6 +110,16 @@ enum GLDrawMode
     GL_LINE_STRIP
 };
 
+/* Perspective projection to screen coordinates:
+ * x' = center_x + x * focal_x / z
+ * y' = center_y - y * focal_y / z
+ * center_y already contains the flip, as Y points down on screen. */
+struct PROJECTION
+{
+    GLFix focal_x, focal_y;
+    GLFix center_x, center_y;
+};
+
 //Range [0-1]
 struct RGB
 {
@@ -96,6 +131,20 @@ struct RGB
 #ifdef FPS_COUNTER
     extern volatile unsigned int fps;
 #endif
+#ifdef RENDER_STATS
+    struct FRAME_STATS {
+        unsigned int vertices; //Transformed with nglMultMatVectRes
+        unsigned int triangles; //Passed to nglDrawTriangle or drawn by nglDrawArray
+        unsigned int culled_backface, culled_frustum, culled_near;
+        unsigned int split; //Additional triangles created by clipping against the near plane or the screen edges
+        unsigned int spans, pixels_tested, pixels_written;
+    };
+    //The counters of the frame being rendered, nglDisplay resets them
+    extern FRAME_STATS frame_stats;
+    #define COUNT_STAT(counter, n) (frame_stats.counter += (n))
+#else
+    #define COUNT_STAT(counter, n) ((void) 0)
+#endif
 extern MATRIX *transformation;
 
 RGB rgbColor(const COLOR c);
@@ -105,13 +154,64 @@ COLOR colorRGB(const GLFix r, const GLFix g, const GLFix b);
 //Invoke once before using any other functions
 void nglInit();
 void nglUninit();
-//The buffer to render to
+//The buffer to render to. Ends the buffer rotation.
 void nglSetBuffer(COLOR *screenBuf);
+/* Allocates count (2 or 3) buffers and renders into them in turn: nglDisplay hands the finished
+ * buffer to a thread which presents it and switches to the next one, so the next frame is rendered
+ * while the previous one is shown. It only waits if the next buffer is still being presented.
+ * Returns the first buffer, use nglGetBuffer after every nglDisplay. 0 ends the rotation.
+ * On the PC, the window is updated from that thread. There are no threads on the calculator,
+ * so the buffers are presented right away. */
+COLOR *nglSetBufferRotation(const unsigned int count);
+//The buffer rendered to
+COLOR *nglGetBuffer();
+//With DIRTY_RECTANGLES or LAZY_CLEAR: Tells nGL that the area x/y to x+w/y+h of buffer gets modified, if it's
+//the one rendered to. Call it before writing into the buffer directly, the texturetools functions do that already.
+void nglMarkDirty(const COLOR *buffer, const int x, const int y, const int w, const int h);
+//Clears and presents the whole buffer next time
+void nglMarkAllDirty();
+#if defined(RENDER_STATS) || defined(OVERDRAW_HEATMAP)
+    //Counts count pixels from first on as written, if buffer is the one rendered to.
+    //For functions writing into the buffer directly, the texturetools functions do that already.
+    void nglCountWritten(const COLOR *buffer, const COLOR *first, const unsigned int count);
+#endif
+#ifdef OVERDRAW_HEATMAP
+    enum NGL_HEATMAP {
+        HEATMAP_OFF = 0,
+        HEATMAP_DEPTH_TESTS, //Depth complexity: Every pixel of a span, whether it passed or not
+        HEATMAP_WRITES //Overdraw: Pixels written, also by texturetools and the ones given to nglCountWritten
+    };
+    struct OVERDRAW_STATS {
+        unsigned int min_tests, max_tests;
+        unsigned int min_writes, max_writes;
+        GLFix avg_tests, avg_writes;
+    };
+    //nglDisplay shows the counts of each pixel instead of the frame, it's off by default.
+    //0 is black, then blue, cyan, green, yellow, orange, red and 7 or more is white.
+    void nglSetHeatmap(const NGL_HEATMAP mode);
+    //The counts of the frame shown by the last nglDisplay. They saturate at 255 per pixel.
+    const OVERDRAW_STATS &nglGetOverdrawStats();
+#endif
+//Sets the focal length of the projection in pixels, 256 by default
 void nglSetNearPlane(const GLFix near_plane);
 GLFix nglGetNearPlane();
+const PROJECTION *nglGetProjection();
 GLFix nglZBufferAt(const unsigned int x, const unsigned int y);
 //Display the buffer
 void nglDisplay();
+//Called by nglDisplay with the finished frame before it's shown, for instance to capture it. nullptr to disable.
+typedef void (*NGLDISPLAYHOOK)(const COLOR *frame);
+void nglSetDisplayHook(NGLDISPLAYHOOK hook);
+//The frame shown by the last nglDisplay, SCREEN_WIDTH*SCREEN_HEIGHT pixels. nullptr before the first one.
+//On the calculator, this is the buffer itself, so it changes when drawing into it again.
+//Waits until the buffer rotation presented all frames.
+const COLOR *nglDisplayedFrame();
+//Whether the frames only end up in memory, see HEADLESS in glconfig_example.h
+bool nglIsHeadless();
+#ifdef RENDER_STATS
+    //The counters of the frame shown by the last nglDisplay
+    const FRAME_STATS &nglGetStats();
+#endif
 void nglSetColor(const COLOR c);
 void nglRotateX(const GLFix a);
 void nglRotateY(const GLFix a);
@@ -139,15 +239,40 @@ void glLoadIdentity();
 void glBegin(const GLDrawMode mode);
 inline void glEnd() { }
 void glClear(const int buffers);
-//This has effectively only integer precision
+//This has effectively only integer precision without WIDE_FIXED_POINT
 void glTranslatef(const GLFix x, const GLFix y, const GLFix z);
 
 void glBindTexture(const TEXTURE *tex);
+//Called by glBindTexture before tex is used, for instance to load it. nullptr to disable.
+typedef void (*NGLBINDTEXTUREHOOK)(const TEXTURE *tex);
+void nglSetBindTextureHook(NGLBINDTEXTUREHOOK hook);
 void glTexCoord2f(const GLFix nu, const GLFix nv);
 void glColor3f(const GLFix r, const GLFix g, const GLFix b);
 void glVertex3f(const GLFix x, const GLFix y, const GLFix z);
 void glScale3f(const GLFix x, const GLFix y, const GLFix z);
 void glPushMatrix();
 void glPopMatrix();
+//Like in OpenGL, but without far plane. Geometry closer than CLIP_PLANE is always clipped.
+//Note that nGL looks in (0,0,1), so left, right, bottom and top are at z = near.
+void glFrustum(const GLFix left, const GLFix right, const GLFix bottom, const GLFix top, const GLFix near);
+//fovy is in degrees, aspect is the width of the view divided by the height.
+void gluPerspective(const GLFix fovy, const GLFix aspect);
+
+#ifdef LIGHTING
+    //Lighting is disabled by default
+    void nglSetLighting(const bool enabled);
+    bool nglGetLighting();
+    //Range [0-1], added to the light of every vertex
+    void nglSetAmbientLight(const GLFix intensity);
+    //Like in OpenGL, direction points towards the light and is transformed with the current matrix.
+    //It doesn't have to be normalized. An intensity of 0 disables the light.
+    void nglSetLight(const unsigned int index, const VECTOR3 &direction, const GLFix intensity);
+    //The normal used for the following vertices, has to be normalized. Default is (0/0/-1), facing the camera.
+    void glNormal3f(const GLFix x, const GLFix y, const GLFix z);
+    //Returns the light [0-1] for a normal, which is transformed with mat first
+    GLFix nglLightIntensity(const MATRIX *mat, const VECTOR3 *normal);
+    //Returns c with the light applied, if a texture is bound only the TEXTURE_SHADE_MASK bits change
+    COLOR nglLightColor(const COLOR c, const GLFix intensity);
+#endif
 
 #endif
@@ -9,17 +9,60 @@
 //If disabled, triangles partially behind the CLIP_PLANE will be discarded
 #define Z_CLIPPING
 
-//If some geometry inaccuracies annoy you, enable this.
-//It's a bit slower though.
-//#define BETTER_PERSPECTIVE
+//Directional lights and an ambient light, applied per vertex.
+//Colored triangles get darker, textured triangles are drawn with one of 4 shade levels.
+//#define LIGHTING
+#define MAX_LIGHTS 2
+
+//If some geometry inaccuracies annoy you or your world is large, enable this.
+//Multiplications and divisions use 64-bit intermediate values, which is a bit slower.
+//#define WIDE_FIXED_POINT
+
+//Interpolate between the entries of the sine table, otherwise the nearest one is used
+#define FASTMATH_INTERPOLATE
+
+//Keep track of the areas drawn into, so that glClear and nglDisplay only touch those and the ones of the
+//previous frame. Helps if only small parts of the screen change. The clear color has to stay the same
+//and writes into the buffer which don't use nGL have to be reported with nglMarkDirty.
+//Useless with nglSetBufferRotation, which always presents everything.
+//#define DIRTY_RECTANGLES
+#define MAX_DIRTY_RECTANGLES 8
+
+//glClear only marks 16x16 tiles as cleared. Each tile is cleared right before something is drawn into it,
+//while it's in the cache, and the remaining ones by nglDisplay. Saves most of the clearing if the
+//scene covers the screen. Like with DIRTY_RECTANGLES, other writes have to be reported with nglMarkDirty.
+//#define LAZY_CLEAR
+
+//PC only: Don't use SDL at all, frames are only rendered into memory. Read them with nglDisplayedFrame.
+//"make -f Makefile.pc HEADLESS=1" defines this and doesn't link SDL. Without it, setting the
+//environment variable NGL_HEADLESS or not having a display has the same effect at runtime.
+//#define HEADLESS
 
 //Print "FPS: <fps>\n" to stdout every second
 //#define FPS_COUNTER
 
+//Measure the time of each frame and parts of it precisely, for percentiles and hitches, see frametiming.h
+//#define FRAME_TIMING
+
+//Count vertices, triangles, culled triangles, spans and pixels of each frame, see nglGetStats.
+//Counting the pixels written costs a bit in the innermost loop.
+//#define RENDER_STATS
+
+//Debugging: Count the depth tests and writes of each pixel, which nglSetHeatmap can show instead
+//of the frame, to find where fill rate is wasted. Slow and uses 2 bytes per pixel.
+//#define OVERDRAW_HEATMAP
+
+//Profiling: Record the time spent in each stage of the pipeline for traceWrite, see trace.h
+//#define TRACE_PROFILING
+
 #if defined(TEXTURE_SUPPORT) && defined(INTERPOLATE_COLORS)
 #error "Colors and textures cannot be used simultaneously!"
 #endif
 
+#if defined(DIRTY_RECTANGLES) && defined(LAZY_CLEAR)
+#error "DIRTY_RECTANGLES and LAZY_CLEAR cannot be used simultaneously!"
+#endif
+
 #define CLIP_PLANE 25
 
 #define MATRIX_STACK_SIZE 10
@@ -1,9 +1,23 @@
+#include <algorithm>
 #include <cassert>
 
 #include "gldrawarray.h"
+#include "trace.h"
 
-/* Create a vertex out of a VECTOR3 and IndexedVertex */
-#define MAKE_VERTEX(vec, iver) { (vec).x, (vec).y, (vec).z, (iver).u, (iver).v, (iver).c }
+#ifdef LIGHTING
+    //Whether the ProcessedPositions of the current draw call have light
+    static bool lit = false;
+    #define VERTEX_COLOR(iver, p) (lit ? nglLightColor((iver).c, (p).light) : (iver).c)
+#else
+    #define VERTEX_COLOR(iver, p) ((iver).c)
+#endif
+
+//Storage of nglDrawArrayInstanced, grows on demand and is freed by nglUninit
+static ProcessedPosition *instance_processed = nullptr;
+static unsigned int instance_processed_size = 0;
+
+/* Create a vertex out of a VECTOR3 and IndexedVertex with its ProcessedPosition */
+#define MAKE_VERTEX(vec, iver, p) { (vec).x, (vec).y, (vec).z, (iver).u, (iver).v, VERTEX_COLOR(iver, p) }
 
 /* Apply perspective to a ProcessedVertex
  * and return the resulting VERTEX.
@@ -17,15 +31,19 @@ static VERTEX perspective(const IndexedVertex &v, ProcessedPosition &p)
         p.perspective_available = true;
     }
 
-    return MAKE_VERTEX(p.perspective, v);
+    return MAKE_VERTEX(p.perspective, v, p);
 }
 
 static bool drawTriangle(ProcessedPosition *processed, const IndexedVertex &low, const IndexedVertex &middle, const IndexedVertex &high, bool backface_culling)
 {
     ProcessedPosition &p_low = processed[low.index], &p_middle = processed[middle.index], &p_high = processed[high.index];
+    COUNT_STAT(triangles, 1);
 
     if(p_low.transformed.z < GLFix(CLIP_PLANE) && p_middle.transformed.z < GLFix(CLIP_PLANE) && p_high.transformed.z < GLFix(CLIP_PLANE))
+    {
+        COUNT_STAT(culled_near, 1);
         return true;
+    }
 
     VERTEX invisible[3];
     const IndexedVertex *visible[3];
@@ -33,7 +51,7 @@ static bool drawTriangle(ProcessedPosition *processed, const IndexedVertex &low,
     unsigned int count_invisible = 0, count_visible = 0;
 
     if(p_low.transformed.z < GLFix(CLIP_PLANE))
-        invisible[count_invisible++] = MAKE_VERTEX(p_low.transformed, low);
+        invisible[count_invisible++] = MAKE_VERTEX(p_low.transformed, low, p_low);
     else
     {
         visible[count_visible] = &low;
@@ -41,7 +59,7 @@ static bool drawTriangle(ProcessedPosition *processed, const IndexedVertex &low,
     }
 
     if(p_middle.transformed.z < GLFix(CLIP_PLANE))
-        invisible[count_invisible++] = MAKE_VERTEX(p_middle.transformed, middle);
+        invisible[count_invisible++] = MAKE_VERTEX(p_middle.transformed, middle, p_middle);
     else
     {
         visible[count_visible] = &middle;
@@ -49,7 +67,7 @@ static bool drawTriangle(ProcessedPosition *processed, const IndexedVertex &low,
     }
 
     if(p_high.transformed.z < GLFix(CLIP_PLANE))
-        invisible[count_invisible++] = MAKE_VERTEX(p_high.transformed, high);
+        invisible[count_invisible++] = MAKE_VERTEX(p_high.transformed, high, p_high);
     else
     {
         visible[count_visible] = &high;
@@ -68,7 +86,7 @@ static bool drawTriangle(ProcessedPosition *processed, const IndexedVertex &low,
         return true;
 #ifdef Z_CLIPPING
     case 1:
-        t0 = MAKE_VERTEX(p_visible[0]->transformed, *visible[0]);
+        t0 = MAKE_VERTEX(p_visible[0]->transformed, *visible[0], *p_visible[0]);
 
         nglInterpolateVertexZ(&invisible[0], &t0, &v1);
         nglInterpolateVertexZ(&invisible[1], &t0, &v2);
@@ -78,14 +96,17 @@ static bool drawTriangle(ProcessedPosition *processed, const IndexedVertex &low,
         nglPerspective(&v2);
 
         if(backface_culling && nglIsBackface(&t0, &v1, &v2))
+        {
+            COUNT_STAT(culled_backface, 1);
             return false;
+        }
 
         nglDrawTriangleZClipped(&t0, &v1, &v2);
         return true;
 
     case 2:
-        t0 = MAKE_VERTEX(p_visible[0]->transformed, *visible[0]);
-        t1 = MAKE_VERTEX(p_visible[1]->transformed, *visible[1]);
+        t0 = MAKE_VERTEX(p_visible[0]->transformed, *visible[0], *p_visible[0]);
+        t1 = MAKE_VERTEX(p_visible[1]->transformed, *visible[1], *p_visible[1]);
 
         nglInterpolateVertexZ(&t0, &invisible[0], &v1);
         nglInterpolateVertexZ(&t1, &invisible[0], &v2);
@@ -99,6 +120,7 @@ static bool drawTriangle(ProcessedPosition *processed, const IndexedVertex &low,
             return false;*/
 
         nglPerspective(&v2);
+        COUNT_STAT(split, 1);
         nglDrawTriangleZClipped(&t0, &t1, &v1);
         nglDrawTriangleZClipped(&t1, &v1, &v2);
         return true;
@@ -109,29 +131,23 @@ static bool drawTriangle(ProcessedPosition *processed, const IndexedVertex &low,
         invisible[2] = perspective(high, p_high);
 
         if(backface_culling && nglIsBackface(&invisible[0], &invisible[1], &invisible[2]))
+        {
+            COUNT_STAT(culled_backface, 1);
             return false;
+        }
 
         nglDrawTriangleZClipped(&invisible[0], &invisible[1], &invisible[2]);
         return true;
 
     default:
+        //Partially behind the near plane without Z_CLIPPING
+        COUNT_STAT(culled_near, 1);
         return true;
     }
 }
 
-void nglDrawArray(const IndexedVertex *vertices, const unsigned int count_vertices, const VECTOR3 *positions, const unsigned int count_positions, ProcessedPosition *processed, const GLDrawMode draw_mode, const bool reset_processed)
+static void drawArray(const IndexedVertex *vertices, const unsigned int count_vertices, ProcessedPosition *processed, const GLDrawMode draw_mode)
 {
-    if(reset_processed)
-    {
-        // Reset processed vertices and apply transformation
-        for(unsigned int i = 0; i < count_positions; ++i)
-        {
-            processed[i].perspective_available = false;
-            nglMultMatVectRes(transformation, &positions[i], &processed[i].transformed);
-        }
-    }
-
-    // Draw
     if(draw_mode == GL_TRIANGLES)
     {
         for(unsigned int i = 0; i < count_vertices; i += 3)
@@ -150,3 +166,132 @@ void nglDrawArray(const IndexedVertex *vertices, const unsigned int count_vertic
         assert(!"Not implemented");
 }
 
+static void transformPositions(const MATRIX *mat, const VECTOR3 *positions, const unsigned int count_positions, ProcessedPosition *processed, const VECTOR3 *normals)
+{
+    TRACE_SCOPE("transform");
+
+    for(unsigned int i = 0; i < count_positions; ++i)
+    {
+        processed[i].perspective_available = false;
+        nglMultMatVectRes(mat, &positions[i], &processed[i].transformed);
+
+        #ifdef LIGHTING
+            if(lit)
+                processed[i].light = nglLightIntensity(mat, &normals[i]);
+        #else
+            (void) normals;
+        #endif
+    }
+}
+
+void nglDrawArray(const IndexedVertex *vertices, const unsigned int count_vertices, const VECTOR3 *positions, const unsigned int count_positions, ProcessedPosition *processed, const GLDrawMode draw_mode, const bool reset_processed, const VECTOR3 *normals)
+{
+    #ifdef LIGHTING
+        lit = normals && nglGetLighting();
+    #endif
+
+    // Reset processed vertices and apply transformation
+    if(reset_processed)
+        transformPositions(transformation, positions, count_positions, processed, normals);
+
+    drawArray(vertices, count_vertices, processed, draw_mode);
+}
+
+/* Returns k * z with the z in [z_min, z_max] which makes it largest. */
+static int64_t maxProduct(const GLFix k, const GLFix z_min, const GLFix z_max)
+{
+    return int64_t(k.value) * (k < GLFix(0) ? z_min : z_max).value;
+}
+
+/* Returns whether the box with the given center and half extents,
+ * both in view space, can't be visible on screen. */
+static bool isBoxInvisible(const VECTOR3 &center, const VECTOR3 &extents)
+{
+    const GLFix z_max = center.z + extents.z;
+    if(z_max < GLFix(CLIP_PLANE))
+        return true;
+
+    // Everything closer gets clipped anyway
+    const GLFix z_min = std::max(center.z - extents.z, GLFix(CLIP_PLANE));
+
+    // A point with z > 0 is visible if 0 <= center_x + x * focal_x / z < SCREEN_WIDTH,
+    // so x * focal_x has to be in [-center_x * z, (SCREEN_WIDTH - center_x) * z).
+    // The box is invisible if its smallest x * focal_x is larger than the largest bound
+    // of all z in the box or its largest x * focal_x smaller than the smallest bound.
+    const PROJECTION *p = nglGetProjection();
+    const int64_t x_min = int64_t((center.x - extents.x).value) * p->focal_x.value,
+                  x_max = int64_t((center.x + extents.x).value) * p->focal_x.value,
+                  y_min = int64_t((center.y - extents.y).value) * p->focal_y.value,
+                  y_max = int64_t((center.y + extents.y).value) * p->focal_y.value;
+
+    // Y is flipped, so y * focal_y has to be in ((center_y - SCREEN_HEIGHT) * z, center_y * z]
+    return x_min > maxProduct(GLFix(SCREEN_WIDTH) - p->center_x, z_min, z_max)
+        || x_max < -maxProduct(p->center_x, z_min, z_max)
+        || y_min > maxProduct(p->center_y, z_min, z_max)
+        || y_max < -maxProduct(GLFix(SCREEN_HEIGHT) - p->center_y, z_min, z_max);
+}
+
+static GLFix absFix(const GLFix f)
+{
+    return f < GLFix(0) ? -f : f;
+}
+
+void nglDrawArrayInstanced(const IndexedVertex *vertices, const unsigned int count_vertices, const VECTOR3 *positions, const unsigned int count_positions, const MATRIX *instances, const unsigned int count_instances, const GLDrawMode draw_mode, const VECTOR3 *normals)
+{
+    if(count_positions == 0)
+        return;
+
+    #ifdef LIGHTING
+        lit = normals && nglGetLighting();
+    #endif
+
+    if(instance_processed_size < count_positions)
+    {
+        delete[] instance_processed;
+        instance_processed = new ProcessedPosition[count_positions];
+        instance_processed_size = count_positions;
+    }
+
+    // Axis aligned bounding box of the mesh, as center and half extents
+    VECTOR3 min = positions[0], max = positions[0];
+    for(unsigned int i = 1; i < count_positions; ++i)
+    {
+        const VECTOR3 &p = positions[i];
+        min.x = std::min(min.x, p.x); max.x = std::max(max.x, p.x);
+        min.y = std::min(min.y, p.y); max.y = std::max(max.y, p.y);
+        min.z = std::min(min.z, p.z); max.z = std::max(max.z, p.z);
+    }
+
+    const VECTOR3 center((min.x + max.x) >> 1, (min.y + max.y) >> 1, (min.z + max.z) >> 1);
+    const VECTOR3 extents((max.x - min.x) >> 1, (max.y - min.y) >> 1, (max.z - min.z) >> 1);
+
+    for(unsigned int i = 0; i < count_instances; ++i)
+    {
+        MATRIX mat = *transformation;
+        nglMultMatMat(&mat, &instances[i]);
+
+        // Transform the bounding box: Each extent of the result is the sum
+        // of the original extents, weighted by the absolute matrix entries.
+        // The center isn't transformed with nglMultMatVectRes, it's not a vertex for RENDER_STATS.
+        VECTOR3 view_center, view_extents;
+        view_center.x = mat.data[0][0]*center.x + mat.data[0][1]*center.y + mat.data[0][2]*center.z + mat.data[0][3];
+        view_center.y = mat.data[1][0]*center.x + mat.data[1][1]*center.y + mat.data[1][2]*center.z + mat.data[1][3];
+        view_center.z = mat.data[2][0]*center.x + mat.data[2][1]*center.y + mat.data[2][2]*center.z + mat.data[2][3];
+        view_extents.x = absFix(mat.data[0][0])*extents.x + absFix(mat.data[0][1])*extents.y + absFix(mat.data[0][2])*extents.z;
+        view_extents.y = absFix(mat.data[1][0])*extents.x + absFix(mat.data[1][1])*extents.y + absFix(mat.data[1][2])*extents.z;
+        view_extents.z = absFix(mat.data[2][0])*extents.x + absFix(mat.data[2][1])*extents.y + absFix(mat.data[2][2])*extents.z;
+
+        if(isBoxInvisible(view_center, view_extents))
+            continue;
+
+        transformPositions(&mat, positions, count_positions, instance_processed, normals);
+        drawArray(vertices, count_vertices, instance_processed, draw_mode);
+    }
+}
+
+void uninitDrawArray()
+{
+    delete[] instance_processed;
+    instance_processed = nullptr;
+    instance_processed_size = 0;
+}
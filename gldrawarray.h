@@ -13,6 +13,9 @@ struct ProcessedPosition {
     VECTOR3 transformed;
     VECTOR3 perspective;
     bool perspective_available;
+#ifdef LIGHTING
+    GLFix light;
+#endif
 };
 
 /* Faster way to draw a mesh.
@@ -20,7 +23,19 @@ struct ProcessedPosition {
  * positions: Array of VECTOR3 with size count_positions the IndexedVertex's refer to
  * processed: Array of ProcessedVertex with size count_positions. Allocate and free it yourself.
  * reset_processed: Set to false if you want to use the same positions with the same transformation. Default is true.
- * draw_mode: GL_TRIANGLES or GL_QUADS */
-void nglDrawArray(const IndexedVertex *vertices, const unsigned int count_vertices, const VECTOR3 *positions, const unsigned int count_positions, ProcessedPosition *processed, const GLDrawMode draw_mode = GL_TRIANGLES, const bool reset_processed = true);
+ * draw_mode: GL_TRIANGLES or GL_QUADS
+ * normals: Array of normalized VECTOR3 with size count_positions, one for each position.
+ *          Only used with LIGHTING, pass nullptr to draw without lighting. */
+void nglDrawArray(const IndexedVertex *vertices, const unsigned int count_vertices, const VECTOR3 *positions, const unsigned int count_positions, ProcessedPosition *processed, const GLDrawMode draw_mode = GL_TRIANGLES, const bool reset_processed = true, const VECTOR3 *normals = nullptr);
+
+/* Draw the same mesh multiple times, once per instance.
+ * vertices, positions, draw_mode and normals: Same as for nglDrawArray
+ * instances: Array of MATRIX with size count_instances, each applied on top of the current transformation
+ * Instances which are completely off-screen are skipped without transforming their positions.
+ * The storage for processed positions is kept between calls until nglUninit,
+ * so like the rest of nGL it mustn't be called from multiple threads at once. */
+void nglDrawArrayInstanced(const IndexedVertex *vertices, const unsigned int count_vertices, const VECTOR3 *positions, const unsigned int count_positions, const MATRIX *instances, const unsigned int count_instances, const GLDrawMode draw_mode = GL_TRIANGLES, const VECTOR3 *normals = nullptr);
+//Called by nglUninit
+void uninitDrawArray();
 
 #endif // GLDRAWARRAY_H
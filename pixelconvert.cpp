@@ -0,0 +1,89 @@
+#include "pixelconvert.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+static inline uint32_t xrgb8888(const COLOR c)
+{
+    const uint32_t r = c >> 11, g = (c >> 5) & 0x3F, b = c & 0x1F;
+    return 0xFF000000 | ((r << 3 | r >> 2) << 16) | ((g << 2 | g >> 4) << 8) | (b << 3 | b >> 2);
+}
+
+typedef uint32_t __attribute__((may_alias)) PixelPair;
+
+void convertRGB565ToXRGB8888(const COLOR *src, uint32_t *dest, unsigned int count)
+{
+    #ifdef __SSE2__
+        const __m128i mask_5 = _mm_set1_epi16(0x1F), mask_6 = _mm_set1_epi16(0x3F), alpha = _mm_set1_epi16(int16_t(0xFF00));
+        for(; count >= 8; count -= 8, src += 8, dest += 8)
+        {
+            const __m128i p = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+            const __m128i r = _mm_srli_epi16(p, 11);
+            const __m128i g = _mm_and_si128(_mm_srli_epi16(p, 5), mask_6);
+            const __m128i b = _mm_and_si128(p, mask_5);
+
+            const __m128i r8 = _mm_or_si128(_mm_slli_epi16(r, 3), _mm_srli_epi16(r, 2));
+            const __m128i g8 = _mm_or_si128(_mm_slli_epi16(g, 2), _mm_srli_epi16(g, 4));
+            const __m128i b8 = _mm_or_si128(_mm_slli_epi16(b, 3), _mm_srli_epi16(b, 2));
+
+            //Little endian: The low half of each pixel is B, G and the high one R, X
+            const __m128i bg = _mm_or_si128(b8, _mm_slli_epi16(g8, 8));
+            const __m128i rx = _mm_or_si128(r8, alpha);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dest), _mm_unpacklo_epi16(bg, rx));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dest + 4), _mm_unpackhi_epi16(bg, rx));
+        }
+    #else
+        //Two pixels per load, once src is aligned
+        if(count && (reinterpret_cast<uintptr_t>(src) & 2))
+        {
+            *dest++ = xrgb8888(*src++);
+            --count;
+        }
+
+        const PixelPair *src2 = reinterpret_cast<const PixelPair*>(src);
+        for(; count >= 2; count -= 2, dest += 2)
+        {
+            //Little endian: The left pixel is in the low half
+            const uint32_t pair = *src2++;
+            dest[0] = xrgb8888(pair & 0xFFFF);
+            dest[1] = xrgb8888(pair >> 16);
+        }
+
+        src = reinterpret_cast<const COLOR*>(src2);
+    #endif
+
+    while(count--)
+        *dest++ = xrgb8888(*src++);
+}
+
+void invertRGB565(const COLOR *src, COLOR *dest, unsigned int count)
+{
+    #ifdef __SSE2__
+        const __m128i ones = _mm_set1_epi32(-1);
+        for(; count >= 8; count -= 8, src += 8, dest += 8)
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dest), _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src)), ones));
+    #else
+        //Two pixels at once, if both are aligned the same way
+        if(((reinterpret_cast<uintptr_t>(src) ^ reinterpret_cast<uintptr_t>(dest)) & 2) == 0)
+        {
+            if(count && (reinterpret_cast<uintptr_t>(src) & 2))
+            {
+                *dest++ = ~*src++;
+                --count;
+            }
+
+            const PixelPair *src2 = reinterpret_cast<const PixelPair*>(src);
+            PixelPair *dest2 = reinterpret_cast<PixelPair*>(dest);
+            for(unsigned int i = count / 2; i--;)
+                *dest2++ = ~*src2++;
+
+            src = reinterpret_cast<const COLOR*>(src2);
+            dest = reinterpret_cast<COLOR*>(dest2);
+            count &= 1;
+        }
+    #endif
+
+    while(count--)
+        *dest++ = ~*src++;
+}
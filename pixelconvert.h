@@ -0,0 +1,16 @@
+#ifndef PIXELCONVERT_H
+#define PIXELCONVERT_H
+
+#include <cstdint>
+
+#include "gl.h"
+
+/* Conversion of lines of RGB565 pixels into the formats of the outputs.
+ * With SSE2 8 pixels are converted at once, otherwise 2 pixels are read per 32-bit word where possible. */
+
+//The 5 and 6 bit channels are expanded to 8 bits by repeating their top bits, X is 0xFF
+void convertRGB565ToXRGB8888(const COLOR *src, uint32_t *dest, unsigned int count);
+//dest may be src
+void invertRGB565(const COLOR *src, COLOR *dest, unsigned int count);
+
+#endif // PIXELCONVERT_H
@@ -0,0 +1,180 @@
+#include <cstdio>
+#include <list>
+#include <string>
+#include <unordered_map>
+
+#include "texturecache.h"
+#include "texturetools.h"
+
+struct CacheEntry {
+    std::string filename;
+    TEXTURE *texture;
+    size_t bytes; //Only valid if resident
+    bool resident;
+};
+
+typedef std::list<CacheEntry>::iterator CacheIterator;
+
+//The most recently used texture is at the front
+static std::list<CacheEntry> entries;
+static std::unordered_map<std::string, CacheIterator> by_filename;
+static std::unordered_map<const TEXTURE*, CacheIterator> by_texture;
+static TEXTURE_CACHE_STATS stats;
+
+//Frees the least recently used textures until the budget is met
+static void evict(const TEXTURE *keep)
+{
+    for(auto it = entries.end(); stats.resident_bytes > stats.budget_bytes && it != entries.begin();)
+    {
+        --it;
+        if(!it->resident || it->texture == keep || it->texture == nglGetTexture())
+            continue;
+
+        freeTextureData(it->texture);
+        it->resident = false;
+        stats.resident_bytes -= it->bytes;
+        stats.resident_textures--;
+        stats.evictions++;
+    }
+}
+
+//Loads the file into entry.texture, which is created if it doesn't exist yet
+static bool load(CacheEntry &entry)
+{
+    TEXTURE *loaded = loadTextureFromFile(entry.filename.c_str());
+    if(!loaded)
+    {
+        printf("Error: Couldn't load texture '%s'!\n", entry.filename.c_str());
+        stats.failed_loads++;
+        return false;
+    }
+
+    if(entry.texture)
+    {
+        *entry.texture = *loaded;
+        delete loaded;
+    }
+    else
+        entry.texture = loaded;
+
+    entry.bytes = textureMemory(*entry.texture);
+    entry.resident = true;
+    stats.resident_bytes += entry.bytes;
+    stats.resident_textures++;
+    return true;
+}
+
+//Marks the entry as most recently used and reloads it if it got evicted
+static bool use(const CacheIterator it)
+{
+    entries.splice(entries.begin(), entries, it);
+
+    if(it->resident)
+    {
+        stats.hits++;
+        return true;
+    }
+
+    stats.misses++;
+    if(!load(*it))
+        return false;
+
+    evict(it->texture);
+    return true;
+}
+
+static void bindHook(const TEXTURE *tex)
+{
+    auto it = by_texture.find(tex);
+    if(it != by_texture.end())
+        use(it->second);
+}
+
+void textureCacheInit(const size_t budget_bytes)
+{
+    stats = TEXTURE_CACHE_STATS();
+    stats.budget_bytes = budget_bytes;
+    nglSetBindTextureHook(bindHook);
+}
+
+void textureCacheUninit()
+{
+    nglSetBindTextureHook(nullptr);
+
+    for(CacheEntry &entry : entries)
+    {
+        if(nglGetTexture() == entry.texture)
+            glBindTexture(nullptr);
+
+        deleteTexture(entry.texture);
+    }
+
+    entries.clear();
+    by_filename.clear();
+    by_texture.clear();
+    stats = TEXTURE_CACHE_STATS();
+}
+
+void textureCacheSetBudget(const size_t budget_bytes)
+{
+    stats.budget_bytes = budget_bytes;
+    evict(nullptr);
+}
+
+TEXTURE *textureCacheGet(const char *filename)
+{
+    auto found = by_filename.find(filename);
+    if(found != by_filename.end())
+        return use(found->second) ? found->second->texture : nullptr;
+
+    stats.misses++;
+
+    entries.push_front(CacheEntry{filename, nullptr, 0, false});
+    if(!load(entries.front()))
+    {
+        entries.pop_front();
+        return nullptr;
+    }
+
+    TEXTURE *texture = entries.front().texture;
+    by_filename[filename] = entries.begin();
+    by_texture[texture] = entries.begin();
+    stats.textures++;
+
+    evict(texture);
+    return texture;
+}
+
+bool textureCacheTouch(const TEXTURE *tex)
+{
+    auto it = by_texture.find(tex);
+    return it != by_texture.end() && use(it->second);
+}
+
+void textureCacheRemove(const TEXTURE *tex)
+{
+    auto found = by_texture.find(tex);
+    if(found == by_texture.end())
+        return;
+
+    const CacheIterator it = found->second;
+    if(it->resident)
+    {
+        stats.resident_bytes -= it->bytes;
+        stats.resident_textures--;
+    }
+
+    if(nglGetTexture() == it->texture)
+        glBindTexture(nullptr);
+
+    stats.textures--;
+    by_texture.erase(found);
+    by_filename.erase(it->filename);
+    deleteTexture(it->texture);
+    entries.erase(it);
+}
+
+TEXTURE_CACHE_STATS textureCacheStats()
+{
+    return stats;
+}
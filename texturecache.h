@@ -0,0 +1,34 @@
+#ifndef TEXTURECACHE_H
+#define TEXTURECACHE_H
+
+#include <cstddef>
+
+#include "gl.h"
+
+/* Textures loaded through the cache are owned by it. If their memory exceeds the budget,
+ * the least recently used ones are evicted: Their data gets freed, but the TEXTURE
+ * itself stays valid and is reloaded from disk when bound with glBindTexture again.
+ * The currently bound texture is never evicted. */
+
+struct TEXTURE_CACHE_STATS {
+    unsigned int hits, misses, evictions, failed_loads;
+    unsigned int textures, resident_textures;
+    size_t resident_bytes, budget_bytes;
+};
+
+//Installs the bind hook with glBindTexture
+void textureCacheInit(const size_t budget_bytes);
+//Deletes all textures of the cache
+void textureCacheUninit();
+void textureCacheSetBudget(const size_t budget_bytes);
+
+//Returns the same TEXTURE for the same filename, nullptr if loading failed
+TEXTURE *textureCacheGet(const char *filename);
+//Makes sure tex is resident, use it before drawing with texturetools. Returns false if reloading failed.
+bool textureCacheTouch(const TEXTURE *tex);
+//Removes tex from the cache and deletes it
+void textureCacheRemove(const TEXTURE *tex);
+
+TEXTURE_CACHE_STATS textureCacheStats();
+
+#endif // TEXTURECACHE_H
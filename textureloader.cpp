@@ -0,0 +1,205 @@
+#include <algorithm>
+#include <cstdio>
+#include <string>
+
+#ifndef _TINSPIRE
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#endif
+
+#include "textureloader.h"
+#include "texturetools.h"
+
+struct TEXTURE_LOAD_REQUEST {
+    std::string filename;
+    TEXTURE *texture;
+    #ifndef _TINSPIRE
+        //Set by the worker after texture, so reading it doesn't need the lock
+        std::atomic<TEXTURE_LOAD_STATE> state;
+        bool cancelled; //Protected by queue_mutex
+    #else
+        TEXTURE_LOAD_STATE state;
+    #endif
+};
+
+#ifndef _TINSPIRE
+
+static std::vector<std::thread> workers;
+static std::deque<TEXTURE_LOAD_REQUEST*> queue;
+static std::mutex queue_mutex;
+static std::condition_variable queue_condition;
+static bool stopping = false;
+
+static void worker()
+{
+    std::unique_lock<std::mutex> lock(queue_mutex);
+    for(;;)
+    {
+        queue_condition.wait(lock, []{ return stopping || !queue.empty(); });
+        if(stopping)
+            return;
+
+        TEXTURE_LOAD_REQUEST *request = queue.front();
+        queue.pop_front();
+
+        lock.unlock();
+        TEXTURE *texture = loadTextureFromFile(request->filename.c_str());
+        lock.lock();
+
+        if(request->cancelled)
+        {
+            if(texture)
+                deleteTexture(texture);
+
+            delete request;
+            continue;
+        }
+
+        request->texture = texture;
+        request->state.store(texture ? TEXTURE_LOAD_DONE : TEXTURE_LOAD_FAILED, std::memory_order_release);
+    }
+}
+
+void textureLoaderInit(unsigned int threads)
+{
+    if(!workers.empty())
+        return;
+
+    if(threads == 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+
+    for(unsigned int i = 0; i < threads; ++i)
+        workers.emplace_back(worker);
+}
+
+void textureLoaderUninit()
+{
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        stopping = true;
+
+        for(TEXTURE_LOAD_REQUEST *request : queue)
+            request->state.store(TEXTURE_LOAD_FAILED, std::memory_order_release);
+
+        queue.clear();
+    }
+
+    queue_condition.notify_all();
+    for(std::thread &thread : workers)
+        thread.join();
+
+    workers.clear();
+    stopping = false;
+}
+
+TEXTURE_LOAD_HANDLE loadTextureAsync(const char *filename)
+{
+    if(workers.empty())
+    {
+        puts("Error: textureLoaderInit wasn't called!");
+        return nullptr;
+    }
+
+    TEXTURE_LOAD_REQUEST *request = new TEXTURE_LOAD_REQUEST;
+    request->filename = filename;
+    request->texture = nullptr;
+    request->state.store(TEXTURE_LOAD_PENDING, std::memory_order_relaxed);
+    request->cancelled = false;
+
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        queue.push_back(request);
+    }
+
+    queue_condition.notify_one();
+    return request;
+}
+
+TEXTURE_LOAD_STATE pollTextureLoad(TEXTURE_LOAD_HANDLE handle)
+{
+    return handle->state.load(std::memory_order_acquire);
+}
+
+void cancelTextureLoad(TEXTURE_LOAD_HANDLE handle)
+{
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+
+        auto queued = std::find(queue.begin(), queue.end(), handle);
+        if(queued != queue.end())
+            queue.erase(queued);
+        else if(handle->state.load(std::memory_order_relaxed) == TEXTURE_LOAD_PENDING)
+        {
+            //A worker is loading it right now and frees it afterwards
+            handle->cancelled = true;
+            return;
+        }
+    }
+
+    if(handle->texture)
+        deleteTexture(handle->texture);
+
+    delete handle;
+}
+
+#else
+
+//No threads, so the loading is done by pollTextureLoad
+static bool running = false;
+
+void textureLoaderInit(unsigned int threads)
+{
+    (void) threads;
+    running = true;
+}
+
+void textureLoaderUninit()
+{
+    running = false;
+}
+
+TEXTURE_LOAD_HANDLE loadTextureAsync(const char *filename)
+{
+    if(!running)
+    {
+        puts("Error: textureLoaderInit wasn't called!");
+        return nullptr;
+    }
+
+    return new TEXTURE_LOAD_REQUEST{filename, nullptr, TEXTURE_LOAD_PENDING};
+}
+
+TEXTURE_LOAD_STATE pollTextureLoad(TEXTURE_LOAD_HANDLE handle)
+{
+    if(handle->state == TEXTURE_LOAD_PENDING)
+    {
+        handle->texture = running ? loadTextureFromFile(handle->filename.c_str()) : nullptr;
+        handle->state = handle->texture ? TEXTURE_LOAD_DONE : TEXTURE_LOAD_FAILED;
+    }
+
+    return handle->state;
+}
+
+void cancelTextureLoad(TEXTURE_LOAD_HANDLE handle)
+{
+    if(handle->texture)
+        deleteTexture(handle->texture);
+
+    delete handle;
+}
+
+#endif
+
+TEXTURE *finishTextureLoad(TEXTURE_LOAD_HANDLE handle)
+{
+    if(pollTextureLoad(handle) == TEXTURE_LOAD_PENDING)
+        return nullptr;
+
+    TEXTURE *texture = handle->texture;
+    delete handle;
+    return texture;
+}
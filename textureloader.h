@@ -0,0 +1,35 @@
+#ifndef TEXTURELOADER_H
+#define TEXTURELOADER_H
+
+#include "gl.h"
+
+/* Loads textures with loadTextureFromFile on background threads, so that
+ * streaming them in doesn't stall the rendering. Poll the handle once per frame
+ * and take the texture with finishTextureLoad once it's done.
+ * The calculator doesn't have threads, so there the file is loaded
+ * by the first pollTextureLoad call of the handle instead. */
+
+enum TEXTURE_LOAD_STATE {
+    TEXTURE_LOAD_PENDING = 0,
+    TEXTURE_LOAD_DONE,
+    TEXTURE_LOAD_FAILED
+};
+
+typedef struct TEXTURE_LOAD_REQUEST *TEXTURE_LOAD_HANDLE;
+
+//Starts the worker threads, 0 uses one per CPU core
+void textureLoaderInit(unsigned int threads = 0);
+//Waits for the running loads, the ones which didn't start yet fail. The handles stay valid.
+void textureLoaderUninit();
+
+//Returns nullptr if the loader isn't running. The handle has to be passed to finishTextureLoad or cancelTextureLoad.
+TEXTURE_LOAD_HANDLE loadTextureAsync(const char *filename);
+//Never waits for the loading thread
+TEXTURE_LOAD_STATE pollTextureLoad(TEXTURE_LOAD_HANDLE handle);
+//Frees the handle and returns the texture, which has to be freed with deleteTexture.
+//Returns nullptr if the load failed. While it's still pending, the handle isn't freed.
+TEXTURE *finishTextureLoad(TEXTURE_LOAD_HANDLE handle);
+//Frees the handle and the texture, if loaded. Doesn't wait if it's currently being loaded.
+void cancelTextureLoad(TEXTURE_LOAD_HANDLE handle);
+
+#endif // TEXTURELOADER_H
@@ -1,9 +1,20 @@
 #include <algorithm>
 #include <cstdio>
+#include <cstring>
 #include <memory>
+#include <vector>
+
+#ifndef _TINSPIRE
+#include <fcntl.h>
+#include <mutex>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 #include "gl.h"
 #include "texturetools.h"
+#include "trace.h"
 
 class ScopedFclose {
 public:
@@ -13,6 +24,17 @@ private:
     FILE *fp;
 };
 
+//Temporary buffer, on the stack if it's small enough
+template <typename T> class ScratchBuffer {
+public:
+    ScratchBuffer(const unsigned int size) : ptr(size <= SCREEN_WIDTH ? stack : (heap.reset(new T[size]), heap.get())) {}
+    T *get() { return ptr; }
+private:
+    T stack[SCREEN_WIDTH];
+    std::unique_ptr<T[]> heap;
+    T *ptr;
+};
+
 TEXTURE* newTexture(const unsigned int w, const unsigned int h, const COLOR fill, const bool transparent, const COLOR transparent_color)
 {
     // TODO: Don't leak on exception
@@ -31,24 +53,266 @@ TEXTURE* newTexture(const unsigned int w, const unsigned int h, const COLOR fill
     ret->has_transparency = transparent;
     ret->transparent_color = transparent_color;
 
+    ret->format = TEXTURE_RGB565;
+    ret->indices = nullptr;
+    ret->palette = nullptr;
+
     return ret;
 }
 
-void deleteTexture(TEXTURE *tex)
+unsigned int paletteSize(const TEXTURE_FORMAT format)
+{
+    return format == TEXTURE_INDEXED8 ? 256 : format == TEXTURE_INDEXED4 ? 16 : 0;
+}
+
+unsigned int indexStride(const TEXTURE &tex)
 {
+    return tex.format == TEXTURE_INDEXED4 ? (tex.width + 1) / 2 : tex.width;
+}
+
+static inline COLOR texelAt(const TEXTURE &tex, const unsigned int x, const unsigned int y)
+{
+    switch(tex.format)
+    {
+    case TEXTURE_INDEXED8:
+        return tex.palette[tex.indices[x + y * tex.width]];
+    case TEXTURE_INDEXED4:
+    {
+        const uint8_t indices = tex.indices[(x >> 1) + y * indexStride(tex)];
+        return tex.palette[(x & 1) ? (indices & 0xF) : (indices >> 4)];
+    }
+    default:
+        return tex.bitmap[x + y * tex.width];
+    }
+}
+
+//Converts w texels of line y, starting at x, to RGB565
+static void decodeLine(const TEXTURE &tex, const unsigned int x, const unsigned int y, const unsigned int w, COLOR *out)
+{
+    if(tex.format == TEXTURE_INDEXED8)
+    {
+        const uint8_t *indices = tex.indices + x + y * tex.width;
+        for(unsigned int i = w; i--;)
+            *out++ = tex.palette[*indices++];
+    }
+    else if(tex.format == TEXTURE_INDEXED4)
+    {
+        for(unsigned int i = 0; i < w; ++i)
+            out[i] = texelAt(tex, x + i, y);
+    }
+    else
+        std::copy(tex.bitmap + x + y * tex.width, tex.bitmap + x + y * tex.width + w, out);
+}
+
+//Returns w texels of line y, starting at x. Paletted textures are decoded into buffer.
+static inline const COLOR *sourceLine(const TEXTURE &tex, const unsigned int x, const unsigned int y, const unsigned int w, COLOR *buffer)
+{
+    if(tex.format == TEXTURE_RGB565)
+        return tex.bitmap + x + y * tex.width;
+
+    decodeLine(tex, x, y, w, buffer);
+    return buffer;
+}
+
+//Only RGB565 textures can be drawn into
+static bool isDrawable(const TEXTURE &tex)
+{
+    if(tex.format == TEXTURE_RGB565)
+        return true;
+
+    puts("Error: Can't draw into a paletted texture!");
+    return false;
+}
+
+//Lets nGL know that an area of tex is about to change, in case it's the screen buffer
+static inline void markDirty(const TEXTURE &tex, const unsigned int x, const unsigned int y, const unsigned int w, const unsigned int h)
+{
+    #if defined(DIRTY_RECTANGLES) || defined(LAZY_CLEAR)
+        if(tex.width == SCREEN_WIDTH && tex.height == SCREEN_HEIGHT)
+            nglMarkDirty(tex.bitmap, x, y, w, h);
+    #else
+        (void) tex; (void) x; (void) y; (void) w; (void) h;
+    #endif
+}
+
+//Counts the pixels stored into tex as written, in case it's the screen buffer.
+//Consecutive pixels are collected into runs, so that nGL is only called once per run.
+class WriteCounter {
+public:
+    WriteCounter(const TEXTURE &tex) : buffer(tex.bitmap) {}
+    #if defined(RENDER_STATS) || defined(OVERDRAW_HEATMAP)
+        ~WriteCounter() { flush(); }
+        void add(const COLOR *first, const unsigned int count = 1)
+        {
+            if(first != run_end)
+            {
+                flush();
+                run_start = first;
+            }
+
+            run_end = first + count;
+        }
+    private:
+        void flush()
+        {
+            if(run_end != run_start)
+                nglCountWritten(buffer, run_start, run_end - run_start);
+        }
+
+        const COLOR *buffer, *run_start = nullptr, *run_end = nullptr;
+    #else
+        void add(const COLOR *first, const unsigned int count = 1) { (void) first; (void) count; (void) buffer; }
+    private:
+        const COLOR *buffer;
+    #endif
+};
+
+/* .ngltex: A header followed by the raw bitmap or indices and palette,
+ * so that loading is just a read or mmap. All fields are little-endian. */
+#define NGLTEX_MAGIC "nGLT"
+#define NGLTEX_VERSION 1
+#define NGLTEX_FLAG_TRANSPARENT (1 << 0)
+
+struct NGLTEX_HEADER {
+    char magic[4];
+    uint16_t version;
+    uint16_t format; //A TEXTURE_FORMAT
+    uint16_t width, height;
+    uint16_t flags;
+    COLOR transparent_color;
+    uint32_t data_offset; //From the start of the file, a multiple of 4
+    uint32_t data_size;
+    uint32_t palette_offset; //Like data_offset, only for paletted formats
+    uint16_t palette_size; //Entries
+    uint16_t reserved;
+};
+
+static_assert(sizeof(NGLTEX_HEADER) == 32, "NGLTEX_HEADER has to be packed without padding");
+
+#ifndef _TINSPIRE
+//Textures which point into a mapped .ngltex file instead of being allocated with new[]
+struct MappedTexture {
+    const void *data;
+    void *mapping;
+    size_t length;
+};
+
+static std::vector<MappedTexture> mapped_textures;
+//Textures can be loaded by the threads of textureloader
+static std::mutex mapped_textures_mutex;
+#endif
+
+void freeTextureData(TEXTURE *tex)
+{
+    #ifndef _TINSPIRE
+        const void *data = tex->format == TEXTURE_RGB565 ? static_cast<const void*>(tex->bitmap) : tex->indices;
+        std::lock_guard<std::mutex> lock(mapped_textures_mutex);
+        for(auto it = mapped_textures.begin(); it != mapped_textures.end(); ++it)
+        {
+            if(it->data != data)
+                continue;
+
+            munmap(it->mapping, it->length);
+            mapped_textures.erase(it);
+            tex->bitmap = nullptr;
+            tex->indices = nullptr;
+            tex->palette = nullptr;
+            return;
+        }
+    #endif
+
     delete[] tex->bitmap;
+    delete[] tex->indices;
+    delete[] tex->palette;
+    tex->bitmap = nullptr;
+    tex->indices = nullptr;
+    tex->palette = nullptr;
+}
+
+void deleteTexture(TEXTURE *tex)
+{
+    freeTextureData(tex);
     delete tex;
 }
 
 void copyTexture(const TEXTURE &src, TEXTURE &dest)
 {
-    if(src.width != dest.width || src.height != dest.height)
+    if(src.width != dest.width || src.height != dest.height || src.format != dest.format)
     {
-        puts("Error: textures don't have the same resolution!");
+        puts("Error: textures don't have the same resolution or format!");
         return;
     }
 
-    std::copy(src.bitmap, src.bitmap + src.width*src.height, dest.bitmap);
+    if(src.format == TEXTURE_RGB565)
+    {
+        markDirty(dest, 0, 0, dest.width, dest.height);
+        std::copy(src.bitmap, src.bitmap + src.width*src.height, dest.bitmap);
+        WriteCounter(dest).add(dest.bitmap, dest.width*dest.height);
+    }
+    else
+    {
+        std::copy(src.indices, src.indices + indexStride(src) * src.height, dest.indices);
+        std::copy(src.palette, src.palette + paletteSize(src.format), dest.palette);
+    }
+}
+
+TEXTURE* convertTexture(const TEXTURE &src, const TEXTURE_FORMAT format)
+{
+    TEXTURE *ret = new TEXTURE;
+    ret->width = src.width;
+    ret->height = src.height;
+    ret->has_transparency = src.has_transparency;
+    ret->transparent_color = src.transparent_color;
+    ret->format = format;
+    ret->bitmap = nullptr;
+    ret->indices = nullptr;
+    ret->palette = nullptr;
+
+    if(format == TEXTURE_RGB565)
+    {
+        ret->bitmap = new COLOR[src.width * src.height];
+        for(unsigned int y = 0; y < src.height; ++y)
+            decodeLine(src, 0, y, src.width, ret->bitmap + y * src.width);
+
+        return ret;
+    }
+
+    const unsigned int max_colors = paletteSize(format), stride = indexStride(*ret);
+    ret->indices = new uint8_t[stride * src.height]{};
+    ret->palette = new COLOR[max_colors]{};
+
+    unsigned int colors = 0, last = 0;
+    for(unsigned int y = 0; y < src.height; ++y)
+    {
+        for(unsigned int x = 0; x < src.width; ++x)
+        {
+            const COLOR c = texelAt(src, x, y);
+
+            //Neighbouring texels often have the same color
+            if(colors == 0 || ret->palette[last] != c)
+            {
+                last = std::find(ret->palette, ret->palette + colors, c) - ret->palette;
+                if(last == colors)
+                {
+                    if(colors == max_colors)
+                    {
+                        printf("Error: Texture has more than %u colors!\n", max_colors);
+                        deleteTexture(ret);
+                        return nullptr;
+                    }
+
+                    ret->palette[colors++] = c;
+                }
+            }
+
+            if(format == TEXTURE_INDEXED8)
+                ret->indices[x + y * stride] = last;
+            else
+                ret->indices[(x >> 1) + y * stride] |= (x & 1) ? last : last << 4;
+        }
+    }
+
+    return ret;
 }
 
 struct RGB24 {
@@ -155,6 +419,181 @@ static TEXTURE* loadTextureFromFile_P7(FILE *texture_file)
     return texture;
 }
 
+//Size of bitmap or indices
+static size_t dataSize(const TEXTURE &texture)
+{
+    if(texture.format == TEXTURE_RGB565)
+        return size_t(texture.width) * texture.height * sizeof(COLOR);
+
+    return size_t(indexStride(texture)) * texture.height;
+}
+
+size_t textureMemory(const TEXTURE &tex)
+{
+    return dataSize(tex) + paletteSize(tex.format) * sizeof(COLOR);
+}
+
+//Whether [offset, offset+size) is inside of the file and after the header
+static bool inFile(const uint32_t offset, const size_t size, const size_t file_size)
+{
+    return offset % 4 == 0 && offset >= sizeof(NGLTEX_HEADER) && offset <= file_size && file_size - offset >= size;
+}
+
+//Returns nullptr if the header is invalid, otherwise a TEXTURE without data
+static TEXTURE *textureFromHeader(const NGLTEX_HEADER &header, const size_t file_size)
+{
+    if(memcmp(header.magic, NGLTEX_MAGIC, sizeof(header.magic)) != 0)
+        return nullptr;
+
+    if(header.version != NGLTEX_VERSION)
+    {
+        printf("Error: Unsupported ngltex version %u!\n", header.version);
+        return nullptr;
+    }
+
+    if(header.format > TEXTURE_INDEXED4)
+    {
+        printf("Error: Unsupported ngltex format %u!\n", header.format);
+        return nullptr;
+    }
+
+    std::unique_ptr<TEXTURE> texture(new TEXTURE);
+    texture->width = header.width;
+    texture->height = header.height;
+    texture->has_transparency = header.flags & NGLTEX_FLAG_TRANSPARENT;
+    texture->transparent_color = header.transparent_color;
+    texture->format = TEXTURE_FORMAT(header.format);
+    texture->bitmap = nullptr;
+    texture->indices = nullptr;
+    texture->palette = nullptr;
+
+    const unsigned int palette_size = paletteSize(texture->format);
+    if(header.width == 0 || header.height == 0 || header.data_size != dataSize(*texture)
+            || !inFile(header.data_offset, header.data_size, file_size)
+            || header.palette_size != palette_size
+            || (palette_size && !inFile(header.palette_offset, palette_size * sizeof(COLOR), file_size)))
+    {
+        puts("Error: Corrupt ngltex file!");
+        return nullptr;
+    }
+
+    return texture.release();
+}
+
+//.ngltex-Loader. On the PC the file is mapped, on the calculator it's read into memory in one go.
+static TEXTURE* loadTextureFromFile_ngltex(FILE *texture_file, const char *filename)
+{
+    #ifndef _TINSPIRE
+        (void) texture_file;
+
+        int fd = open(filename, O_RDONLY);
+        if(fd < 0)
+            return nullptr;
+
+        struct stat st;
+        if(fstat(fd, &st) != 0 || size_t(st.st_size) < sizeof(NGLTEX_HEADER))
+        {
+            close(fd);
+            return nullptr;
+        }
+
+        //Private and writable, so that the texture can be modified like any other
+        void *mapping = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if(mapping == MAP_FAILED)
+            return nullptr;
+
+        const NGLTEX_HEADER &header = *static_cast<const NGLTEX_HEADER*>(mapping);
+        TEXTURE *texture = textureFromHeader(header, st.st_size);
+        if(!texture)
+        {
+            munmap(mapping, st.st_size);
+            return nullptr;
+        }
+
+        char *data = static_cast<char*>(mapping) + header.data_offset;
+        if(texture->format == TEXTURE_RGB565)
+            texture->bitmap = reinterpret_cast<COLOR*>(data);
+        else
+        {
+            texture->indices = reinterpret_cast<uint8_t*>(data);
+            texture->palette = reinterpret_cast<COLOR*>(static_cast<char*>(mapping) + header.palette_offset);
+        }
+
+        std::lock_guard<std::mutex> lock(mapped_textures_mutex);
+        mapped_textures.push_back(MappedTexture{data, mapping, size_t(st.st_size)});
+
+        return texture;
+    #else
+        (void) filename;
+
+        NGLTEX_HEADER header;
+        if(fseek(texture_file, 0, SEEK_END) != 0)
+            return nullptr;
+
+        const long file_size = ftell(texture_file);
+        if(file_size < long(sizeof(header)) || fseek(texture_file, 0, SEEK_SET) != 0
+                || fread(&header, sizeof(header), 1, texture_file) != 1)
+            return nullptr;
+
+        std::unique_ptr<TEXTURE, void(*)(TEXTURE*)> texture(textureFromHeader(header, file_size), deleteTexture);
+        if(!texture)
+            return nullptr;
+
+        void *data;
+        if(texture->format == TEXTURE_RGB565)
+            data = texture->bitmap = new COLOR[texture->width * texture->height];
+        else
+        {
+            data = texture->indices = new uint8_t[header.data_size];
+            texture->palette = new COLOR[header.palette_size];
+
+            if(fseek(texture_file, header.palette_offset, SEEK_SET) != 0
+                    || fread(texture->palette, header.palette_size * sizeof(COLOR), 1, texture_file) != 1)
+                return nullptr;
+        }
+
+        if(fseek(texture_file, header.data_offset, SEEK_SET) != 0
+                || fread(data, header.data_size, 1, texture_file) != 1)
+            return nullptr;
+
+        return texture.release();
+    #endif
+}
+
+static bool saveTextureToFile_ngltex(const TEXTURE &texture, FILE *file)
+{
+    NGLTEX_HEADER header = {};
+    memcpy(header.magic, NGLTEX_MAGIC, sizeof(header.magic));
+    header.version = NGLTEX_VERSION;
+    header.format = texture.format;
+    header.width = texture.width;
+    header.height = texture.height;
+    header.flags = texture.has_transparency ? NGLTEX_FLAG_TRANSPARENT : 0;
+    header.transparent_color = texture.transparent_color;
+    header.data_offset = sizeof(header);
+    header.data_size = dataSize(texture);
+
+    if(texture.format == TEXTURE_RGB565)
+        return fwrite(&header, sizeof(header), 1, file) == 1
+                && fwrite(texture.bitmap, header.data_size, 1, file) == 1;
+
+    //The palette comes first, so that the indices are aligned without padding
+    header.palette_offset = sizeof(header);
+    header.palette_size = paletteSize(texture.format);
+    header.data_offset = header.palette_offset + header.palette_size * sizeof(COLOR);
+
+    return fwrite(&header, sizeof(header), 1, file) == 1
+            && fwrite(texture.palette, header.palette_size * sizeof(COLOR), 1, file) == 1
+            && fwrite(texture.indices, header.data_size, 1, file) == 1;
+}
+
+static bool hasExtension(const char *filename, const char *extension)
+{
+    const size_t len = strlen(filename), ext_len = strlen(extension);
+    return len >= ext_len && strcmp(filename + len - ext_len, extension) == 0;
+}
+
 //PPM-Loader without support for ascii
 TEXTURE* loadTextureFromFile(const char* filename)
 {
@@ -173,6 +612,9 @@ TEXTURE* loadTextureFromFile(const char* filename)
     if(strcmp(magic, "P7") == 0)
         return loadTextureFromFile_P7(texture_file);
 
+    if(strncmp(magic, NGLTEX_MAGIC, 2) == 0)
+        return loadTextureFromFile_ngltex(texture_file, filename);
+
     if(strcmp(magic, "P6") != 0)
         return nullptr;
 
@@ -237,22 +679,26 @@ bool saveTextureToFile(const TEXTURE &texture, const char *filename)
 
     ScopedFclose fc(f);
 
+    if(hasExtension(filename, ".ngltex"))
+        return saveTextureToFile_ngltex(texture, f);
+
     if(fprintf(f, "P6 %d %d %d ", texture.width, texture.height, 255) < 0)
         return false;
 
-    unsigned int pixels = texture.width * texture.height;
-    RGB24 *buffer24 = new RGB24[pixels];
+    RGB24 *buffer24 = new RGB24[texture.width * texture.height];
 
     //Convert to RGB24
     RGB24 *ptr24 = buffer24;
-    COLOR *ptr16 = texture.bitmap;
-    while(pixels--)
+    for(unsigned int y = 0; y < texture.height; ++y)
     {
-        ptr24->r = (*ptr16 & 0b1111100000000000) >> 8;
-        ptr24->g = (*ptr16 & 0b0000011111100000) >> 3;
-        ptr24->b = (*ptr16 & 0b0000000000011111) << 3;
-        ++ptr24;
-        ++ptr16;
+        for(unsigned int x = 0; x < texture.width; ++x)
+        {
+            const COLOR c = texelAt(texture, x, y);
+            ptr24->r = (c & 0b1111100000000000) >> 8;
+            ptr24->g = (c & 0b0000011111100000) >> 3;
+            ptr24->b = (c & 0b0000000000011111) << 3;
+            ++ptr24;
+        }
     }
 
     bool ret = fwrite(buffer24, sizeof(RGB24), texture.width * texture.height, f) == static_cast<unsigned int>(texture.width) * texture.height;
@@ -272,51 +718,322 @@ TextureAtlasEntry textureArea(const unsigned int x, const unsigned int y, const
     };
 }
 
+//Bottom-left skyline packer: The top edge of the used space is a list of horizontal segments.
+struct SkylineSegment {
+    unsigned int x, y, w;
+};
+
+class SkylinePacker {
+public:
+    SkylinePacker(const unsigned int w, const unsigned int h) : width(w), height(h), skyline{{0, 0, w}} {}
+
+    //Returns false if there's no space left for w x h
+    bool insert(const unsigned int w, const unsigned int h, unsigned int &x, unsigned int &y)
+    {
+        unsigned int best_index = skyline.size(), best_x = 0, best_y = height;
+
+        for(unsigned int i = 0; i < skyline.size(); ++i)
+        {
+            unsigned int top;
+            if(fits(i, w, h, top) && top < best_y)
+            {
+                best_index = i;
+                best_x = skyline[i].x;
+                best_y = top;
+            }
+        }
+
+        if(best_index == skyline.size())
+            return false;
+
+        x = best_x;
+        y = best_y;
+        place(best_index, x, y + h, w);
+        return true;
+    }
+
+private:
+    //Whether a rectangle starting at segment i fits, top is the lowest y it can be placed at
+    bool fits(unsigned int i, const unsigned int w, const unsigned int h, unsigned int &top) const
+    {
+        const unsigned int x = skyline[i].x;
+        if(x + w > width)
+            return false;
+
+        top = 0;
+        for(unsigned int covered = 0; covered < w; ++i)
+        {
+            top = std::max(top, skyline[i].y);
+            if(top + h > height)
+                return false;
+
+            covered = skyline[i].x + skyline[i].w - x;
+        }
+
+        return true;
+    }
+
+    void place(const unsigned int i, const unsigned int x, const unsigned int y, const unsigned int w)
+    {
+        skyline.insert(skyline.begin() + i, SkylineSegment{x, y, w});
+
+        //Cut away what's now covered by the new segment
+        const unsigned int end = x + w;
+        while(i + 1 < skyline.size() && skyline[i + 1].x < end)
+        {
+            SkylineSegment &next = skyline[i + 1];
+            const unsigned int next_end = next.x + next.w;
+            if(next_end <= end)
+                skyline.erase(skyline.begin() + i + 1);
+            else
+            {
+                next.w = next_end - end;
+                next.x = end;
+                break;
+            }
+        }
+
+        //Merge neighbours of the same height
+        for(unsigned int j = 0; j + 1 < skyline.size();)
+        {
+            if(skyline[j].y == skyline[j + 1].y)
+            {
+                skyline[j].w += skyline[j + 1].w;
+                skyline.erase(skyline.begin() + j + 1);
+            }
+            else
+                ++j;
+        }
+    }
+
+    const unsigned int width, height;
+    std::vector<SkylineSegment> skyline;
+};
+
+//Copies src to (x|y) and repeats its edges padding times around it
+static void blitPadded(const TEXTURE &src, TEXTURE &dest, const unsigned int x, const unsigned int y, const unsigned int padding, const bool keep_transparency)
+{
+    if(src.width == 0 || src.height == 0)
+        return;
+
+    const unsigned int dest_left = x - padding, padded_w = src.width + 2 * padding;
+
+    for(unsigned int row = 0; row < src.height; ++row)
+    {
+        COLOR *dest_line = dest.bitmap + (y + row) * dest.width + dest_left;
+        decodeLine(src, 0, row, src.width, dest_line + padding);
+
+        for(unsigned int col = 0; col < src.width; ++col)
+        {
+            COLOR c = dest_line[padding + col];
+            //The atlas uses 0 as transparent color, like the rasterizer
+            if(src.has_transparency && c == src.transparent_color)
+                c = 0;
+            else if(keep_transparency && c == 0)
+                c = 0b0000100000100001;
+
+            dest_line[padding + col] = c;
+        }
+
+        std::fill(dest_line, dest_line + padding, dest_line[padding]);
+        std::fill(dest_line + padding + src.width, dest_line + padded_w, dest_line[padding + src.width - 1]);
+    }
+
+    const COLOR *first_line = dest.bitmap + y * dest.width + dest_left,
+                *last_line = dest.bitmap + (y + src.height - 1) * dest.width + dest_left;
+    for(unsigned int i = 1; i <= padding; ++i)
+    {
+        std::copy(first_line, first_line + padded_w, dest.bitmap + (y - i) * dest.width + dest_left);
+        std::copy(last_line, last_line + padded_w, dest.bitmap + (y + src.height - 1 + i) * dest.width + dest_left);
+    }
+}
+
+unsigned int packTextureAtlas(const TEXTURE * const *textures, const unsigned int count,
+                              const unsigned int atlas_w, const unsigned int atlas_h, const unsigned int padding,
+                              TextureAtlasEntry *entries, unsigned int *atlas_indices,
+                              TEXTURE **atlases, const unsigned int max_atlases)
+{
+    //Placing the tallest textures first wastes less space
+    std::vector<unsigned int> order(count);
+    bool has_transparency = false;
+    for(unsigned int i = 0; i < count; ++i)
+    {
+        order[i] = i;
+        has_transparency |= textures[i]->has_transparency;
+    }
+
+    std::stable_sort(order.begin(), order.end(), [textures](const unsigned int a, const unsigned int b) {
+        return textures[a]->height > textures[b]->height;
+    });
+
+    std::vector<SkylinePacker> packers;
+    std::vector<unsigned int> placed_in(count);
+
+    for(unsigned int i : order)
+    {
+        const unsigned int w = textures[i]->width + 2 * padding, h = textures[i]->height + 2 * padding;
+        unsigned int x = 0, y = 0, atlas;
+
+        for(atlas = 0; atlas < packers.size(); ++atlas)
+        {
+            if(packers[atlas].insert(w, h, x, y))
+                break;
+        }
+
+        if(atlas == packers.size())
+        {
+            if(packers.size() == max_atlases)
+            {
+                printf("Error: Textures don't fit into %u atlases!\n", max_atlases);
+                return 0;
+            }
+
+            packers.emplace_back(atlas_w, atlas_h);
+            if(!packers.back().insert(w, h, x, y))
+            {
+                printf("Error: Texture %u doesn't fit into an atlas!\n", i);
+                return 0;
+            }
+        }
+
+        placed_in[i] = atlas;
+        entries[i] = textureArea(x + padding, y + padding, textures[i]->width, textures[i]->height);
+    }
+
+    for(unsigned int atlas = 0; atlas < packers.size(); ++atlas)
+        atlases[atlas] = newTexture(atlas_w, atlas_h, 0, has_transparency, 0);
+
+    for(unsigned int i = 0; i < count; ++i)
+    {
+        blitPadded(*textures[i], *atlases[placed_in[i]], entries[i].left, entries[i].top, padding, has_transparency);
+        if(atlas_indices)
+            atlas_indices[i] = placed_in[i];
+    }
+
+    return packers.size();
+}
+
+void remapTextureCoords(IndexedVertex *vertices, const unsigned int count, const TextureAtlasEntry &area)
+{
+    for(unsigned int i = 0; i < count; ++i)
+    {
+        vertices[i].u += GLFix(area.left);
+        vertices[i].v += GLFix(area.top);
+    }
+}
+
+void remapTextureCoords(VERTEX *vertices, const unsigned int count, const TextureAtlasEntry &area)
+{
+    for(unsigned int i = 0; i < count; ++i)
+    {
+        vertices[i].u += GLFix(area.left);
+        vertices[i].v += GLFix(area.top);
+    }
+}
+
+//Two RGB565 pixels at once. The ARM926 doesn't have SIMD, but word accesses halve the memory operations.
+typedef uint32_t __attribute__((may_alias)) PixelPair;
+
+static inline bool samePairAlignment(const COLOR *a, const COLOR *b)
+{
+	return ((reinterpret_cast<uintptr_t>(a) ^ reinterpret_cast<uintptr_t>(b)) & 2) == 0;
+}
+
+//Copy w pixels, except the ones which are key
+static void blitLineKeyed(COLOR *dest, const COLOR *src, unsigned int w, const COLOR key)
+{
+	if(samePairAlignment(dest, src))
+	{
+		if(w && (reinterpret_cast<uintptr_t>(dest) & 2))
+		{
+			if(*src != key)
+				*dest = *src;
+
+			++dest;
+			++src;
+			--w;
+		}
+
+		PixelPair *dest2 = reinterpret_cast<PixelPair*>(dest);
+		const PixelPair *src2 = reinterpret_cast<const PixelPair*>(src);
+		const uint32_t key_low = key, key_high = uint32_t(key) << 16;
+
+		for(unsigned int i = w / 2; i--; ++dest2, ++src2)
+		{
+			const uint32_t c = *src2;
+
+			//Mask of the halves to keep from dest
+			uint32_t keep = 0;
+			if((c & 0xFFFF) == key_low)
+				keep |= 0xFFFF;
+			if((c & 0xFFFF0000) == key_high)
+				keep |= 0xFFFF0000;
+
+			if(keep == 0)
+				*dest2 = c;
+			else if(keep != 0xFFFFFFFF)
+				*dest2 = (*dest2 & keep) | (c & ~keep);
+		}
+
+		dest = reinterpret_cast<COLOR*>(dest2);
+		src = reinterpret_cast<const COLOR*>(src2);
+		w &= 1;
+	}
+
+	while(w--)
+	{
+		const COLOR c = *src++;
+		if(c != key)
+			*dest = c;
+
+		++dest;
+	}
+}
+
 void drawTexture(const TEXTURE &src, TEXTURE &dest,
 				 uint16_t src_x, uint16_t src_y, uint16_t src_w, uint16_t src_h,
 				 uint16_t dest_x, uint16_t dest_y, uint16_t dest_w, uint16_t dest_h)
 {
+	TRACE_SCOPE("drawTexture");
+	
 	if(src_x + src_w > src.width || src_y + src_h > src.height || dest_x + dest_w > dest.width || dest_y + dest_h > dest.height)
 		return;
 	
-	uint16_t *dest_ptr = dest.bitmap + dest_x + dest_y * dest.width;
-	const unsigned int dest_nextline = dest.width - dest_w;
+	if(!isDrawable(dest))
+		return;
+	
+	markDirty(dest, dest_x, dest_y, dest_w, dest_h);
+	WriteCounter written(dest);
+	
+	COLOR *dest_ptr = dest.bitmap + dest_x + dest_y * dest.width;
+	//Only used for paletted textures
+	ScratchBuffer<COLOR> line(src.format == TEXTURE_RGB565 ? 0 : src_w);
 	
 	//Special cases, for better performance
 	if(src_w == dest_w && src_h == dest_h)
 	{
-		dest_w = std::min(src_w, static_cast<uint16_t>(dest.width - dest_x));
-		dest_h = std::min(src_h, static_cast<uint16_t>(dest.height - dest_y));
-		
-		const uint16_t *src_ptr = src.bitmap + src_x + src_y * src.width;
-		const unsigned int src_nextline = src.width - dest_w;
-		
-		if(!src.has_transparency)
+		for(unsigned int i = 0; i < dest_h; ++i, dest_ptr += dest.width)
 		{
-			for(unsigned int i = dest_h; i--;)
+			if(!src.has_transparency)
 			{
-				for(unsigned int j = dest_w; j--;)
-					*dest_ptr++ = *src_ptr++;
+				if(src.format == TEXTURE_RGB565)
+				{
+					const COLOR *src_ptr = src.bitmap + src_x + (src_y + i) * src.width;
+					std::copy(src_ptr, src_ptr + dest_w, dest_ptr);
+				}
+				else
+					decodeLine(src, src_x, src_y + i, dest_w, dest_ptr);
 				
-				dest_ptr += dest_nextline;
-				src_ptr += src_nextline;
+				written.add(dest_ptr, dest_w);
 			}
-		}
-		else
-		{
-			for(unsigned int i = dest_h; i--;)
+			else
 			{
-				for(unsigned int j = dest_w; j--;)
-				{
-					uint16_t c = *src_ptr++;
-					if(c != src.transparent_color)
-						*dest_ptr = c;
-					
-					++dest_ptr;
-				}
+				const COLOR *src_ptr = sourceLine(src, src_x, src_y + i, dest_w, line.get());
+				blitLineKeyed(dest_ptr, src_ptr, dest_w, src.transparent_color);
 				
-				dest_ptr += dest_nextline;
-				src_ptr += src_nextline;
+				for(unsigned int j = 0; j < dest_w; ++j)
+					if(src_ptr[j] != src.transparent_color)
+						written.add(dest_ptr + j);
 			}
 		}
 		
@@ -324,53 +1041,74 @@ void drawTexture(const TEXTURE &src, TEXTURE &dest,
 	}
 	
 	const GLFix dx_src = GLFix(src_w) / dest_w, dy_src = GLFix(src_h) / dest_h;
-	uint16_t *dest_line_end = std::min(dest_ptr + dest_w, dest.bitmap + dest.width * dest.height);
-	const uint16_t *dest_ptr_end = std::min(dest_ptr + dest.width * dest_h, dest.bitmap + dest.height * dest.width);
 	
-	GLFix src_fx = src_x, src_fy = src_y;
+	//The source column of each destination column is the same for every line
+	ScratchBuffer<uint16_t> columns(dest_w);
+	
+	GLFix src_fx = 0;
+	for(unsigned int j = 0; j < dest_w; ++j, src_fx += dx_src)
+		columns.get()[j] = src_fx.floor();
+	
+	GLFix src_fy = src_y;
+	int prev_src_y = -1;
+	const COLOR *src_line = nullptr;
 	
-	if(!src.has_transparency)
+	for(unsigned int i = dest_h; i--; dest_ptr += dest.width, src_fy += dy_src)
 	{
-		while(dest_ptr < dest_ptr_end)
+		const int line_y = src_fy.floor();
+		const bool same_line = line_y == prev_src_y;
+		if(!same_line)
+			src_line = sourceLine(src, src_x, line_y, src_w, line.get());
+		
+		if(!src.has_transparency)
 		{
-			src_fx = src_x;
-			
-			while(dest_ptr < dest_line_end)
-			{	
-				*dest_ptr++ = src.bitmap[(src_fy.floor() * src.width) + src_fx.floor()];
-				
-				src_fx += dx_src;
+			//When scaling up, lines repeat. Just copy the previous one then.
+			if(same_line)
+				std::copy(dest_ptr - dest.width, dest_ptr - dest.width + dest_w, dest_ptr);
+			else
+			{
+				for(unsigned int j = 0; j < dest_w; ++j)
+					dest_ptr[j] = src_line[columns.get()[j]];
 			}
 			
-			dest_ptr += dest_nextline;
-			dest_line_end += dest.width;
-			src_fy += dy_src;
+			written.add(dest_ptr, dest_w);
 		}
-	}
-	else
-	{
-		while(dest_ptr < dest_ptr_end)
+		else
 		{
-			src_fx = src_x;
-			
-			while(dest_ptr < dest_line_end)
+			for(unsigned int j = 0; j < dest_w; ++j)
 			{
-				uint16_t c = src.bitmap[(src_fy.floor() * src.width) + src_fx.floor()];
+				const COLOR c = src_line[columns.get()[j]];
 				if(c != src.transparent_color)
-					*dest_ptr = c;
-				
-				src_fx += dx_src;
-				++dest_ptr;
+				{
+					dest_ptr[j] = c;
+					written.add(dest_ptr + j);
+				}
 			}
-			
-			dest_ptr += dest_nextline;
-			dest_line_end += dest.width;
-			src_fy += dy_src;
 		}
+		
+		prev_src_y = line_y;
 	}
 }
 
-void drawTextureOverlay(const TEXTURE &src, const unsigned int src_x, const unsigned int src_y, TEXTURE &dest, const unsigned int dest_x, const unsigned int dest_y, unsigned int w, unsigned int h)
+//Spreads the RGB565 fields apart, so that they can be multiplied by a 5-bit factor in one go
+static inline uint32_t spreadColor(const COLOR c)
+{
+    return (c | (uint32_t(c) << 16)) & 0x07E0F81F;
+}
+
+static inline COLOR packColor(const uint32_t c)
+{
+    return (c & 0xFFFF) | (c >> 16);
+}
+
+//alpha is 0-32
+static inline COLOR blendColor(const COLOR src, const COLOR dest, const unsigned int alpha)
+{
+    const uint32_t c = spreadColor(src) * alpha + spreadColor(dest) * (32 - alpha);
+    return packColor((c >> 5) & 0x07E0F81F);
+}
+
+void drawTextureOverlay(const TEXTURE &src, const unsigned int src_x, const unsigned int src_y, TEXTURE &dest, const unsigned int dest_x, const unsigned int dest_y, unsigned int w, unsigned int h, const uint8_t opacity, const uint8_t *alpha_mask)
 {
     if(dest_x >= dest.width || dest_y >= dest.height)
         return;
@@ -378,6 +1116,9 @@ void drawTextureOverlay(const TEXTURE &src, const unsigned int src_x, const unsi
     if(src_x >= src.width || src_y >= src.height)
         return;
 
+    if(!isDrawable(dest))
+        return;
+
     // Clip
     w = std::min(w, dest.width - dest_x);
     h = std::min(h, dest.height - dest_y);
@@ -385,37 +1126,163 @@ void drawTextureOverlay(const TEXTURE &src, const unsigned int src_x, const unsi
     h = std::min(h, src.height - src_y);
 
     COLOR *dest_ptr = dest.bitmap + dest_x + dest_y * dest.width;
-    const COLOR *src_ptr = src.bitmap + src_x + src_y * src.width;
-    const unsigned int nextline_dest = dest.width - w, nextline_src = src.width - w;
+    const uint8_t *mask_ptr = alpha_mask ? alpha_mask + src_x + src_y * src.width : nullptr;
+    //Only used for paletted textures
+    ScratchBuffer<COLOR> line(src.format == TEXTURE_RGB565 ? 0 : w);
+
+    //From 0-255 to 0-32
+    const unsigned int alpha = (opacity + 4) >> 3;
+    if(!alpha_mask && alpha == 0)
+        return;
 
-    for(unsigned int i = h; i--;)
+    markDirty(dest, dest_x, dest_y, w, h);
+    WriteCounter written(dest);
+
+    for(unsigned int i = 0; i < h; ++i, dest_ptr += dest.width)
     {
-        for(unsigned int j = w; j--;)
+        const COLOR *src_ptr = sourceLine(src, src_x, src_y + i, w, line.get());
+        COLOR *dest = dest_ptr;
+
+        if(!alpha_mask)
         {
-            const COLOR srcc = *src_ptr++;
-            COLOR *dest = dest_ptr++;
+            for(unsigned int j = w; j--; ++dest)
+            {
+                const COLOR srcc = *src_ptr++;
+                if(src.has_transparency && srcc == src.transparent_color)
+                    continue;
 
+                *dest = alpha == 32 ? srcc : blendColor(srcc, *dest, alpha);
+                written.add(dest);
+            }
+
+            continue;
+        }
+
+        for(unsigned int j = 0; j < w; ++j, ++dest)
+        {
+            const COLOR srcc = *src_ptr++;
             if(src.has_transparency && srcc == src.transparent_color)
                 continue;
 
-            const unsigned int r_o = (*dest >> 11) & 0b11111;
-            const unsigned int g_o = (*dest >> 5) & 0b111111;
-            const unsigned int b_o = (*dest >> 0) & 0b11111;
+            const unsigned int pixel_alpha = (((opacity * (mask_ptr[j] + 1)) >> 8) + 4) >> 3;
+            if(pixel_alpha == 0)
+                continue;
+
+            *dest = pixel_alpha == 32 ? srcc : blendColor(srcc, *dest, pixel_alpha);
+            written.add(dest);
+        }
+
+        mask_ptr += src.width;
+    }
+}
+
+//Appends the (skip, copy) pairs of a line. If runs is nullptr, they're only counted.
+static void encodeRuns(const TEXTURE &src, const COLOR *line, uint16_t *runs, COLOR *pixels, uint32_t &run_count, uint32_t &pixel_count)
+{
+    const unsigned int w = src.width;
+    unsigned int x = 0;
+    for(;;)
+    {
+        const unsigned int skip_start = x;
+        while(x < w && src.has_transparency && line[x] == src.transparent_color)
+            ++x;
 
-            const unsigned int r_n = (srcc >> 11) & 0b11111;
-            const unsigned int g_n = (srcc >> 5) & 0b111111;
-            const unsigned int b_n = (srcc >> 0) & 0b11111;
+        if(x == w)
+            return;
 
-            //Generate 50% opacity
-            const unsigned int r = (r_n + r_o) >> 1;
-            const unsigned int g = (g_n + g_o) >> 1;
-            const unsigned int b = (b_n + b_o) >> 1;
+        const unsigned int copy_start = x;
+        while(x < w && !(src.has_transparency && line[x] == src.transparent_color))
+            ++x;
 
-            *dest = (r << 11) | (g << 5) | (b << 0);
+        if(runs)
+        {
+            runs[run_count] = copy_start - skip_start;
+            runs[run_count + 1] = x - copy_start;
+            std::copy(line + copy_start, line + x, pixels + pixel_count);
         }
 
-        dest_ptr += nextline_dest;
-        src_ptr += nextline_src;
+        run_count += 2;
+        pixel_count += x - copy_start;
+    }
+}
+
+COMPILED_SPRITE* compileSprite(const TEXTURE &src)
+{
+    std::unique_ptr<COMPILED_SPRITE> sprite(new COMPILED_SPRITE{src.width, src.height, nullptr, nullptr, nullptr, nullptr});
+    ScratchBuffer<COLOR> line(src.format == TEXTURE_RGB565 ? 0 : src.width);
+
+    //Count first, so that everything can be allocated at once
+    uint32_t run_count = 0, pixel_count = 0;
+    for(unsigned int y = 0; y < src.height; ++y)
+        encodeRuns(src, sourceLine(src, 0, y, src.width, line.get()), nullptr, nullptr, run_count, pixel_count);
+
+    std::unique_ptr<uint32_t[]> lines(new uint32_t[src.height + 1]), line_pixels(new uint32_t[src.height + 1]);
+    std::unique_ptr<uint16_t[]> runs(new uint16_t[run_count]);
+    std::unique_ptr<COLOR[]> pixels(new COLOR[pixel_count]);
+
+    run_count = pixel_count = 0;
+    for(unsigned int y = 0; y < src.height; ++y)
+    {
+        lines[y] = run_count;
+        line_pixels[y] = pixel_count;
+        encodeRuns(src, sourceLine(src, 0, y, src.width, line.get()), runs.get(), pixels.get(), run_count, pixel_count);
+    }
+
+    lines[src.height] = run_count;
+    line_pixels[src.height] = pixel_count;
+
+    sprite->lines = lines.release();
+    sprite->line_pixels = line_pixels.release();
+    sprite->runs = runs.release();
+    sprite->pixels = pixels.release();
+    return sprite.release();
+}
+
+void deleteSprite(COMPILED_SPRITE *sprite)
+{
+    delete[] sprite->lines;
+    delete[] sprite->line_pixels;
+    delete[] sprite->runs;
+    delete[] sprite->pixels;
+    delete sprite;
+}
+
+void drawSprite(const COMPILED_SPRITE &sprite, TEXTURE &dest, const int x, const int y)
+{
+    if(!isDrawable(dest))
+        return;
+
+    //Visible area, in sprite coordinates
+    const int left = std::max(0, -x), right = std::min(int(sprite.width), dest.width - x);
+    const int top = std::max(0, -y), bottom = std::min(int(sprite.height), dest.height - y);
+    if(left >= right || top >= bottom)
+        return;
+
+    markDirty(dest, x + left, y + top, right - left, bottom - top);
+    WriteCounter written(dest);
+
+    COLOR *dest_line = dest.bitmap + (y + top) * dest.width;
+    for(int i = top; i < bottom; ++i, dest_line += dest.width)
+    {
+        const uint16_t *run = sprite.runs + sprite.lines[i], *runs_end = sprite.runs + sprite.lines[i + 1];
+        const COLOR *pixels = sprite.pixels + sprite.line_pixels[i];
+
+        for(int pos = 0; run != runs_end && pos < right; run += 2)
+        {
+            pos += run[0];
+            const int copy_end = pos + run[1];
+
+            //Runs are only cut at the edges of dest
+            const int from = std::max(pos, left), to = std::min(copy_end, right);
+            if(from < to)
+            {
+                std::copy(pixels + (from - pos), pixels + (to - pos), dest_line + (x + from));
+                written.add(dest_line + (x + from), to - from);
+            }
+
+            pixels += run[1];
+            pos = copy_end;
+        }
     }
 }
 
@@ -423,7 +1290,7 @@ TEXTURE* resizeTexture(const TEXTURE &src, const unsigned int w, const unsigned
 {
     TEXTURE *ret = newTexture(w, h);
 
-    if(w == src.width && h == src.height)
+    if(w == src.width && h == src.height && src.format == TEXTURE_RGB565)
     {
         copyTexture(src, *ret);
         return ret;
@@ -433,15 +1300,23 @@ TEXTURE* resizeTexture(const TEXTURE &src, const unsigned int w, const unsigned
 
     for(unsigned int dsty = 0; dsty < h; dsty++)
         for(unsigned int dstx = 0; dstx < w; dstx++)
-            *ptr++ = src.bitmap[(dstx * src.width / w) + (dsty * src.height / h) * src.width];
+            *ptr++ = texelAt(src, dstx * src.width / w, dsty * src.height / h);
 
     return ret;
 }
 
 void greyscaleTexture(TEXTURE &tex)
 {
-    unsigned int pixels = tex.width * tex.height;
-    COLOR *ptr16 = tex.bitmap;
+    //For paletted textures, changing the palette is enough
+    const bool paletted = tex.format != TEXTURE_RGB565;
+    unsigned int pixels = paletted ? paletteSize(tex.format) : tex.width * tex.height;
+    COLOR *ptr16 = paletted ? tex.palette : tex.bitmap;
+    if(!paletted)
+    {
+        markDirty(tex, 0, 0, tex.width, tex.height);
+        WriteCounter(tex).add(tex.bitmap, pixels);
+    }
+
     while(pixels--)
     {
         const RGB rgb = rgbColor(*ptr16);
@@ -456,13 +1331,21 @@ void drawRectangle(TEXTURE &tex, const unsigned int x, const unsigned int y, uns
     if(x >= tex.width || y >= tex.height || w < 2 || h < 2)
         return;
 
+    if(!isDrawable(tex))
+        return;
+
     w = std::min(w, tex.width - x);
     h = std::min(h, tex.height - y);
 
+    markDirty(tex, x, y, w, h);
+
     //Draw top and bottom lines
     unsigned int w1 = w;
     COLOR *line_start_top = tex.bitmap + y * tex.width + x,
             *line_start_bot = tex.bitmap + (y+h-1) * tex.width + x;
+    WriteCounter written(tex);
+    written.add(line_start_top, w);
+    written.add(line_start_bot, w);
     while(w1--)
     {
         *line_start_top++ = c;
@@ -477,5 +1360,7 @@ void drawRectangle(TEXTURE &tex, const unsigned int x, const unsigned int y, uns
     {
         *(line_start_top += tex.width) = c;
         *(line_start_bot += tex.width) = c;
+        written.add(line_start_top);
+        written.add(line_start_bot);
     }
 }
@@ -2,24 +2,61 @@
 #define TEXTURETOOLS_H
 
 #include "gl.h"
+#include "gldrawarray.h"
 
 //Throws if allocation failed
 TEXTURE* newTexture(const unsigned int w, const unsigned int h, const COLOR fill = 0, const bool transparent = true, const COLOR transparent_color = 0);
 void deleteTexture(TEXTURE *tex);
+//Frees bitmap, indices and palette and sets them to nullptr, but keeps tex itself
+void freeTextureData(TEXTURE *tex);
+//Bytes used by bitmap, indices and palette
+size_t textureMemory(const TEXTURE &tex);
 
-//Textures have to have the same resolution
+//Textures have to have the same resolution and format
 void copyTexture(const TEXTURE &src, TEXTURE &dest);
 
-//Returns nullptr if loading failed
+//Number of palette entries of paletted formats, 0 for TEXTURE_RGB565
+unsigned int paletteSize(const TEXTURE_FORMAT format);
+//Bytes per line of TEXTURE::indices
+unsigned int indexStride(const TEXTURE &tex);
+//Allocates a copy of src in a different format, deleteTexture must be called.
+//Returns nullptr if src has more colors than the palette can hold.
+TEXTURE* convertTexture(const TEXTURE &src, const TEXTURE_FORMAT format);
+
+//Supports binary PPM (P6), PAM (P7) with alpha and .ngltex. Returns nullptr if loading failed.
+//.ngltex files are mapped directly on the PC, deleteTexture unmaps them again.
 TEXTURE *loadTextureFromFile(const char* filename);
+//Writes .ngltex if the filename ends with it, PPM otherwise
 bool saveTextureToFile(const TEXTURE &texture, const char* filename);
 
+//Paletted textures can be used as source, but not as destination of the drawing functions below.
+
 //Normal blitting
 void drawTexture(const TEXTURE &src, TEXTURE &dest,
 				 uint16_t src_x, uint16_t src_y, uint16_t src_w, uint16_t src_h,
 				 uint16_t dest_x, uint16_t dest_y, uint16_t dest_w, uint16_t dest_h);
-//50% opacity
-void drawTextureOverlay(const TEXTURE &src, const unsigned int src_x, const unsigned int src_y, TEXTURE &dest, const unsigned int dest_x, const unsigned int dest_y, unsigned int w, unsigned int h);
+//Blends src over dest. opacity goes from 0 (invisible) to 255 (opaque), the default is 50%.
+//alpha_mask, if given, has one opacity value per pixel of src and is multiplied with opacity.
+void drawTextureOverlay(const TEXTURE &src, const unsigned int src_x, const unsigned int src_y, TEXTURE &dest, const unsigned int dest_x, const unsigned int dest_y, unsigned int w, unsigned int h,
+                        const uint8_t opacity = 128, const uint8_t *alpha_mask = nullptr);
+
+/* A TEXTURE compiled for fast colour-keyed blitting. Every line is stored as pairs
+ * of (transparent, opaque) run lengths and only the opaque pixels are kept,
+ * so drawing it doesn't have to test any pixels. */
+struct COMPILED_SPRITE
+{
+    uint16_t width; uint16_t height;
+    uint32_t *lines; //height + 1 offsets into runs, line y uses runs[lines[y]] to runs[lines[y + 1] - 1]
+    uint32_t *line_pixels; //Offset into pixels of each line
+    uint16_t *runs; //skip, copy, skip, copy, ... Transparent pixels at the end of a line aren't stored.
+    COLOR *pixels;
+};
+
+//Throws if allocation failed, deleteSprite must be called
+COMPILED_SPRITE* compileSprite(const TEXTURE &src);
+void deleteSprite(COMPILED_SPRITE *sprite);
+//Draws the sprite with its top left corner at x/y, which may be partly or completely outside of dest
+void drawSprite(const COMPILED_SPRITE &sprite, TEXTURE &dest, const int x, const int y);
 //Allocates memory for new texture, deleteTexture must be called
 TEXTURE* resizeTexture(const TEXTURE &src, const unsigned int w, const unsigned int h);
 //Makes the texture greyscale
@@ -36,4 +73,20 @@ struct TextureAtlasEntry
 
 TextureAtlasEntry textureArea(const unsigned int x, const unsigned int y, const unsigned int w, const unsigned int h);
 
+/* Packs textures into up to max_atlases new atlas textures of atlas_w x atlas_h.
+ * Each texture is surrounded by padding pixels which repeat its edges, so that
+ * sampling slightly outside of an area doesn't pick up the neighbours.
+ * entries[i] is set to the area of textures[i] in atlases[atlas_indices[i]].
+ * atlas_indices may be nullptr if max_atlases is 1.
+ * Returns the number of atlases created, which have to be freed with deleteTexture,
+ * or 0 if the textures don't fit. */
+unsigned int packTextureAtlas(const TEXTURE * const *textures, const unsigned int count,
+                              const unsigned int atlas_w, const unsigned int atlas_h, const unsigned int padding,
+                              TextureAtlasEntry *entries, unsigned int *atlas_indices,
+                              TEXTURE **atlases, const unsigned int max_atlases);
+
+//Moves u/v from the original texture into its area of an atlas
+void remapTextureCoords(IndexedVertex *vertices, const unsigned int count, const TextureAtlasEntry &area);
+void remapTextureCoords(VERTEX *vertices, const unsigned int count, const TextureAtlasEntry &area);
+
 #endif // TEXTURETOOLS_H
@@ -1,5 +1,6 @@
 #!/usr/bin/python
 import os
+import struct
 import sys
 from PIL import Image
 
@@ -38,12 +39,25 @@ def tex2ngl(src):
 
     return out, "tex_" + name, (width, height)
 
+def tex2ngltex(src):
+    """Converts src to the binary .ngltex format. Returns bytes."""
+    img = Image.open(src).convert("RGB")
+    width, height = img.size
+    data = b"".join(struct.pack("<H", color2ngl(*rgb)) for rgb in img.getdata())
+
+    # magic, version, format (RGB565), width, height, flags, transparent color, data offset, data size, reserved
+    header = struct.pack("<4sHHHHHHII8x", b"nGLT", 1, 0, width, height, 0, 0, 32, len(data))
+    return header + data
+
 def main(argv):
     if len(argv) != 2 and len(argv) != 3:
-        print("Usage: tex2ngl.py <input.png> (<output.h>)\nDoes not yet support transparency")
+        print("Usage: tex2ngl.py <input.png> (<output.h|output.ngltex>)\nDoes not yet support transparency")
         return 2
 
     outputpath = argv[2] if len(argv) > 2 else os.path.splitext(argv[1])[0] + ".h"
+    if outputpath.endswith(".ngltex"):
+        return 0 if open(outputpath, "wb").write(tex2ngltex(argv[1])) else 1
+
     return 0 if open(outputpath, "w").write(tex2ngl(argv[1])[0]) else 1
 
 if __name__ == "__main__":
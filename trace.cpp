@@ -0,0 +1,127 @@
+#include <algorithm>
+#include <cstdio>
+#include <memory>
+#include <vector>
+
+#ifndef _TINSPIRE
+#include <mutex>
+#endif
+
+#include "trace.h"
+
+#ifdef TRACE_PROFILING
+
+struct TraceEvent {
+    const char *name;
+    uint64_t start, end;
+};
+
+struct TraceBuffer {
+    unsigned int thread;
+    uint64_t count; //Of all recorded events, the ring has the last TRACE_BUFFER_SIZE
+    TraceEvent events[TRACE_BUFFER_SIZE];
+};
+
+//Buffers stay alive after their thread ended, so that its events can still be written
+static std::vector<std::unique_ptr<TraceBuffer>> buffers;
+#ifndef _TINSPIRE
+    static std::mutex buffers_mutex;
+    static thread_local TraceBuffer *thread_buffer;
+#else
+    static TraceBuffer *thread_buffer;
+#endif
+
+static TraceBuffer *newBuffer()
+{
+    #ifndef _TINSPIRE
+        std::lock_guard<std::mutex> lock(buffers_mutex);
+    #endif
+
+    buffers.emplace_back(new TraceBuffer());
+    buffers.back()->thread = buffers.size();
+    return buffers.back().get();
+}
+
+void traceRecord(const char *name, const uint64_t start, const uint64_t end)
+{
+    if(__builtin_expect(!thread_buffer, false))
+        thread_buffer = newBuffer();
+
+    TraceEvent &event = thread_buffer->events[thread_buffer->count++ % TRACE_BUFFER_SIZE];
+    event.name = name;
+    event.start = start;
+    event.end = end;
+}
+
+//The ring only has the events from this one on
+static uint64_t oldestEvent(const TraceBuffer &buffer)
+{
+    return std::max(buffer.count, uint64_t(TRACE_BUFFER_SIZE)) - TRACE_BUFFER_SIZE;
+}
+
+static void writeString(FILE *file, const char *str)
+{
+    fputc('"', file);
+    for(; *str; ++str)
+    {
+        if(*str == '"' || *str == '\\')
+            fputc('\\', file);
+
+        fputc(*str, file);
+    }
+    fputc('"', file);
+}
+
+bool traceWrite(const char *path)
+{
+    #ifndef _TINSPIRE
+        std::lock_guard<std::mutex> lock(buffers_mutex);
+    #endif
+
+    FILE *file = fopen(path, "w");
+    if(!file)
+        return false;
+
+    //Timestamps relative to the first event, the clock's origin is meaningless anyway
+    uint64_t origin = UINT64_MAX;
+    for(auto &buffer : buffers)
+        for(uint64_t i = oldestEvent(*buffer); i < buffer->count; ++i)
+            origin = std::min(origin, buffer->events[i % TRACE_BUFFER_SIZE].start);
+
+    unsigned long long dropped = 0;
+    for(auto &buffer : buffers)
+        dropped += oldestEvent(*buffer);
+
+    fprintf(file, "{\"displayTimeUnit\": \"ns\", \"otherData\": {\"dropped_events\": %llu}, \"traceEvents\": [\n", dropped);
+
+    const char *separator = "";
+    for(auto &buffer : buffers)
+    {
+        for(uint64_t i = oldestEvent(*buffer); i < buffer->count; ++i)
+        {
+            const TraceEvent &event = buffer->events[i % TRACE_BUFFER_SIZE];
+            fprintf(file, "%s{\"name\": ", separator);
+            writeString(file, event.name);
+            //Complete events with the times in microseconds
+            fprintf(file, ", \"cat\": \"nGL\", \"ph\": \"X\", \"pid\": 1, \"tid\": %u, \"ts\": %.3f, \"dur\": %.3f}",
+                    buffer->thread, (event.start - origin) / 1000.0, (event.end - event.start) / 1000.0);
+            separator = ",\n";
+        }
+    }
+
+    fputs("\n]}\n", file);
+    const bool ok = !ferror(file);
+    return fclose(file) == 0 && ok;
+}
+
+void traceClear()
+{
+    #ifndef _TINSPIRE
+        std::lock_guard<std::mutex> lock(buffers_mutex);
+    #endif
+
+    for(auto &buffer : buffers)
+        buffer->count = 0;
+}
+
+#endif
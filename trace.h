@@ -0,0 +1,62 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include "gl.h"
+
+/* With TRACE_PROFILING, TRACE_SCOPE(name) measures the time until the end of the enclosing block.
+ * nGL has markers around the stages of the pipeline and applications can add their own.
+ * Each thread records into its own ring buffer of TRACE_BUFFER_SIZE events, so only the latest ones are kept.
+ * traceWrite saves them in the Chrome trace event format, which chrome://tracing or ui.perfetto.dev can show.
+ * Without TRACE_PROFILING, the markers compile to nothing. */
+
+#ifdef TRACE_PROFILING
+
+#ifndef TRACE_BUFFER_SIZE
+    #define TRACE_BUFFER_SIZE 65536
+#endif
+
+#ifndef _TINSPIRE
+    #include <chrono>
+#else
+    #include <ctime>
+#endif
+
+//Nanoseconds of a monotonic clock. The calculator only has clock(), so the resolution is much worse there.
+static inline uint64_t traceNow()
+{
+    #ifndef _TINSPIRE
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    #else
+        return uint64_t(clock()) * 1000000000u / CLOCKS_PER_SEC;
+    #endif
+}
+
+//name has to stay valid until traceWrite, string literals are best
+void traceRecord(const char *name, const uint64_t start, const uint64_t end);
+
+class TraceScope {
+public:
+    explicit TraceScope(const char *name) : name(name), start(traceNow()) {}
+    ~TraceScope() { traceRecord(name, start, traceNow()); }
+
+private:
+    const char *name;
+    uint64_t start;
+};
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(trace_scope_, __LINE__)(name)
+
+//Both read or reset the buffers of all threads, so only call them while no other thread records events,
+//e.g. after nglDisplayedFrame, which waits until the presenting is done. traceWrite returns false on errors.
+bool traceWrite(const char *path);
+void traceClear();
+
+#else
+
+#define TRACE_SCOPE(name) ((void) 0)
+
+#endif
+
+#endif // TRACE_H
@@ -1,6 +1,21 @@
 //This file will be included in gl.cpp for various different versions
+//TEXEL_VARIANT appends the texture format to the name of the function and TEXEL reads a texel
+#ifndef TEXEL_INDEXED
+    #define TEXEL_VARIANT(name) name
+    #define TEXEL(u, v) loc_texture.bitmap[(u) + (v)*loc_texture.width]
+#elif TEXEL_INDEXED == 8
+    #define TEXEL_VARIANT(name) name##Indexed8
+    #define TEXEL(u, v) loc_texture.palette[loc_texture.indices[(u) + (v)*loc_texture.width]]
+#else
+    #define TEXEL_VARIANT(name) name##Indexed4
+    #define TEXEL(u, v) texelIndexed4(loc_texture, index_stride, (u), (v))
+#endif
+
 #ifdef TRANSPARENCY
-    static void nglDrawTransparentTriangleXZClipped(const VERTEX *low, const VERTEX *middle, const VERTEX *high)
+    static void TEXEL_VARIANT(nglDrawTransparentTriangleXZClipped)(const VERTEX *low, const VERTEX *middle, const VERTEX *high)
+    {
+#elif defined(TEXEL_INDEXED)
+    static void TEXEL_VARIANT(nglDrawTriangleXZClipped)(const VERTEX *low, const VERTEX *middle, const VERTEX *high)
     {
 #else
     #ifdef FORCE_COLOR
@@ -13,7 +28,14 @@
                 if(!texture)
                     return nglDrawTriangleXZClippedForceColor(low, middle, high);
 
-                if(__builtin_expect((low->c & TEXTURE_TRANSPARENT) == TEXTURE_TRANSPARENT, 0))
+                const bool transparent = __builtin_expect((low->c & TEXTURE_TRANSPARENT) == TEXTURE_TRANSPARENT, 0);
+
+                if(texture->format == TEXTURE_INDEXED8)
+                    return transparent ? nglDrawTransparentTriangleXZClippedIndexed8(low, middle, high) : nglDrawTriangleXZClippedIndexed8(low, middle, high);
+                else if(texture->format == TEXTURE_INDEXED4)
+                    return transparent ? nglDrawTransparentTriangleXZClippedIndexed4(low, middle, high) : nglDrawTriangleXZClippedIndexed4(low, middle, high);
+
+                if(transparent)
                     return nglDrawTransparentTriangleXZClipped(low, middle, high);
             #endif
     #endif
@@ -168,8 +190,17 @@
     #ifdef TEXTURE_SUPPORT
         //Stack access is faster
         TEXTURE loc_texture = *texture;
+        #if TEXEL_INDEXED == 4
+            const unsigned int index_stride = (loc_texture.width + 1) / 2;
+        #endif
+
+        #ifdef LIGHTING
+            const TEXTURE_SHADE shade = texture_shades[lighting ? (low->c & TEXTURE_SHADE_MASK) : 0];
+        #endif
     #endif
 
+    TRACE_SCOPE("spans");
+
     //If xstart will get smaller than xend
     if(dx_lower < dx_far)
         goto otherway;
@@ -180,6 +211,13 @@
         const int line_width = x2 - x1;
         if(__builtin_expect(line_width >= 1, true))
         {
+            #ifdef LAZY_CLEAR
+                clearTilesOfSpan(y, x1, x2);
+            #endif
+
+            COUNT_STAT(spans, 1);
+            COUNT_STAT(pixels_tested, x2 - x1 + 1);
+
             const auto inv_l = Fix<16, int32_t>(1) / line_width;
             const TriFix dz = (zend - zstart) * inv_l;
             TriFix z = zstart;
@@ -200,26 +238,42 @@
             decltype(screen) screen_buf = screen_buf_line + x1;
             for(int x = x1; x <= x2; x += 1, ++z_buf, ++screen_buf)
             {
+                COUNT_OVERDRAW(overdraw_tests, screen_buf - screen);
+
                 if(__builtin_expect(TriFix(*z_buf) > z, true))
                 {
                     #ifdef TEXTURE_SUPPORT
-                        COLOR c = loc_texture.bitmap[u.floor() + v.floor()*loc_texture.width];
+                        COLOR c = TEXEL(u.floor(), v.floor());
                         #ifdef TRANSPARENCY
                             if(__builtin_expect(c != 0x0000, 1))
                             {
+                                #ifdef LIGHTING
+                                    c = ((c >> shade.shift) & shade.mask) - ((c >> 2) & shade.mask_sub);
+                                #endif
                                 *screen_buf = c;
                                 *z_buf = z;
+                                COUNT_STAT(pixels_written, 1);
+                                COUNT_OVERDRAW(overdraw_writes, screen_buf - screen);
                             }
                         #else
+                            #ifdef LIGHTING
+                                c = ((c >> shade.shift) & shade.mask) - ((c >> 2) & shade.mask_sub);
+                            #endif
                             *screen_buf = c;
                             *z_buf = z;
+                            COUNT_STAT(pixels_written, 1);
+                            COUNT_OVERDRAW(overdraw_writes, screen_buf - screen);
                         #endif
                     #elif defined(INTERPOLATE_COLORS)
                         *screen_buf = colorRGB(r, g, b);
                         *z_buf = z;
+                        COUNT_STAT(pixels_written, 1);
+                        COUNT_OVERDRAW(overdraw_writes, screen_buf - screen);
                     #else
                         *screen_buf = low->c;
                         *z_buf = z;
+                        COUNT_STAT(pixels_written, 1);
+                        COUNT_OVERDRAW(overdraw_writes, screen_buf - screen);
                     #endif
                 }
 
@@ -282,6 +336,13 @@
         const int line_width = x1 - x2;
         if(__builtin_expect(line_width <= -1, true))
         {
+            #ifdef LAZY_CLEAR
+                clearTilesOfSpan(y, x1, x2);
+            #endif
+
+            COUNT_STAT(spans, 1);
+            COUNT_STAT(pixels_tested, x2 - x1 + 1);
+
             const auto inv_l = Fix<16, int32_t>(1) / line_width;
             //Here are the differences
             const TriFix dz = (zend - zstart) * inv_l;
@@ -303,26 +364,42 @@
             decltype(screen) screen_buf = screen_buf_line + x1;
             for(int x = x1; x <= x2; x += 1, ++z_buf, ++screen_buf)
             {
+                COUNT_OVERDRAW(overdraw_tests, screen_buf - screen);
+
                 if(__builtin_expect(TriFix(*z_buf) > z, true))
                 {
                     #ifdef TEXTURE_SUPPORT
-                        COLOR c = loc_texture.bitmap[u.floor() + v.floor()*loc_texture.width];
+                        COLOR c = TEXEL(u.floor(), v.floor());
                         #ifdef TRANSPARENCY
                             if(__builtin_expect(c != 0x0000, 1))
                             {
+                                #ifdef LIGHTING
+                                    c = ((c >> shade.shift) & shade.mask) - ((c >> 2) & shade.mask_sub);
+                                #endif
                                 *screen_buf = c;
                                 *z_buf = z;
+                                COUNT_STAT(pixels_written, 1);
+                                COUNT_OVERDRAW(overdraw_writes, screen_buf - screen);
                             }
                         #else
+                            #ifdef LIGHTING
+                                c = ((c >> shade.shift) & shade.mask) - ((c >> 2) & shade.mask_sub);
+                            #endif
                             *screen_buf = c;
                             *z_buf = z;
+                            COUNT_STAT(pixels_written, 1);
+                            COUNT_OVERDRAW(overdraw_writes, screen_buf - screen);
                         #endif
                     #elif defined(INTERPOLATE_COLORS)
                         *screen_buf = colorRGB(r, g, b);
                         *z_buf = z;
+                        COUNT_STAT(pixels_written, 1);
+                        COUNT_OVERDRAW(overdraw_writes, screen_buf - screen);
                     #else
                         *screen_buf = low->c;
                         *z_buf = z;
+                        COUNT_STAT(pixels_written, 1);
+                        COUNT_OVERDRAW(overdraw_writes, screen_buf - screen);
                     #endif
                 }
 
@@ -377,3 +454,6 @@
         }
     }
 }
+
+#undef TEXEL_VARIANT
+#undef TEXEL